@@ -0,0 +1,45 @@
+#pragma once
+#ifndef ALIGNEDALLOC_H
+#define ALIGNEDALLOC_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Cache-line aligned, zero-initialised float buffers for the solver fields.
+const size_t fieldAlignment = 64;
+
+// Number of floats per SIMD-friendly row: count rounded up to a whole cache line.
+inline int paddedRowLength(int count) {
+    const int floatsPerLine = static_cast<int>(fieldAlignment / sizeof(float));
+    return (count + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+}
+
+inline float* allocAlignedFloats(size_t count) {
+    size_t bytes = count * sizeof(float);
+    if (bytes == 0) bytes = fieldAlignment;
+    void* ptr = nullptr;
+#ifdef _WIN32
+    ptr = _aligned_malloc(bytes, fieldAlignment);
+#else
+    if (posix_memalign(&ptr, fieldAlignment, bytes) != 0) ptr = nullptr;
+#endif
+    if (!ptr) throw std::bad_alloc();
+    std::memset(ptr, 0, bytes);
+    return static_cast<float*>(ptr);
+}
+
+inline void freeAlignedFloats(float* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+#endif
@@ -0,0 +1,397 @@
+// Kernel micro-benchmark: times diffuse, advect, project, setBoundary and a
+// full step of FluidSim against FluidSimBaseline (the original scalar code)
+// over grid sizes, obstacle fractions and thread counts, and prints JSON.
+// Whole steps of FluidSim3D are timed against FluidSim3DBaseline, its
+// scalar single-threaded counterpart, and a FluidEnsemble of --members
+// simulations against as many FluidSims stepped one after another (sizes up
+// to 512, first obstacle fraction), in the "solvers" block.
+//
+// Usage: fluidsim_bench [--sizes 64,128,...] [--obstacles 0,0.05,0.2]
+//                       [--threads 1,2,...] [--sizes-3d 32,64] [--members 8]
+//                       [--min-time seconds] [--out file]
+//
+// With T threads, T independent simulations run the kernel concurrently and
+// the figures are aggregate throughput. Bytes and flops per cell come from a
+// simple traffic model of each kernel (the "model" block in the output), so
+// GB/s and GFLOP/s compare implementations rather than measure hardware
+// counters.
+
+#include "FluidSim.h"
+#include "FluidSim3D.h"
+#include "FluidSim3DBaseline.h"
+#include "FluidSimBaseline.h"
+#include "FluidEnsemble.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum Kernel
+{
+    KernelDiffuse,
+    KernelAdvect,
+    KernelProject,
+    KernelSetBoundary,
+    KernelStep,
+    KernelCount
+};
+
+struct KernelModel
+{
+    const char* name;
+    double bytesPerCell;    // main-memory traffic of one call
+    double flopsPerCell;
+};
+
+// diffuse: 20 sweeps reading x0, x and the mask and writing x, plus a mask
+// pass per sweep in setBoundary. advect: both velocity components, reading
+// u, v, the mask and four corners per component. project: divergence pass,
+// 20 pressure sweeps and the gradient pass. step: two diffuses, two projects,
+// the velocity advect and the density diffuse and advect.
+static const KernelModel models[KernelCount] = {
+    { "diffuse", 20 * 14.0, 20 * 7.0 },
+    { "advect", 27.0, 26.0 },
+    { "project", 17.0 + 20 * 14.0 + 21.0 + 4.0, 5.0 + 20 * 5.0 + 6.0 },
+    { "setBoundary", 1.0, 0.0 },
+    { "step", 2 * 280.0 + 2 * 322.0 + 27.0 + 280.0 + 17.0, 2 * 140.0 + 2 * 111.0 + 26.0 + 140.0 + 13.0 }
+};
+
+// Calls the private kernels of both solvers on their own fields.
+class FluidSimBenchmark
+{
+public:
+    static void run(FluidSim& sim, Kernel kernel) {
+        sim.commitObstacles();
+        switch (kernel) {
+        case KernelDiffuse: sim.diffuse(1, sim.Vx0, sim.Vx, sim.viscosity); break;
+        case KernelAdvect: sim.advectVelocity(sim.Vx0, sim.Vy0, sim.Vx, sim.Vy); break;
+        case KernelProject: sim.project(sim.Vx, sim.Vy, sim.Vx0, sim.Vy0); break;
+        case KernelSetBoundary: sim.setBoundary(1, sim.Vx); break;
+        default: sim.step(); break;
+        }
+    }
+
+    static void run(FluidSimBaseline& sim, Kernel kernel) {
+        switch (kernel) {
+        case KernelDiffuse: sim.diffuse(1, sim.Vx0, sim.Vx, sim.viscosity); break;
+        case KernelAdvect:
+            sim.advect(1, sim.Vx0, sim.Vx, sim.Vx, sim.Vy);
+            sim.advect(2, sim.Vy0, sim.Vy, sim.Vx, sim.Vy);
+            break;
+        case KernelProject: sim.project(sim.Vx, sim.Vy, sim.Vx0, sim.Vy0); break;
+        case KernelSetBoundary: sim.setBoundary(1, sim.Vx); break;
+        default: sim.step(); break;
+        }
+    }
+};
+
+// Wind-tunnel walls, a centred square covering obstacleFraction of the grid,
+// a swirling velocity field of a few cells per step and density everywhere.
+template <class Sim>
+static void setUp(Sim& sim, float obstacleFraction) {
+    const int n = sim.getSize();
+    for (int i = 0; i < n; i++) {
+        sim.setObstacle(i, 0, true);
+        sim.setObstacle(i, n - 1, true);
+    }
+    int side = static_cast<int>(std::sqrt(obstacleFraction) * n);
+    int start = (n - side) / 2;
+    for (int j = start; j < start + side; j++) {
+        for (int i = start; i < start + side; i++) {
+            sim.setObstacle(i, j, true);
+        }
+    }
+
+    const float pi = 3.14159265f;
+    const float speed = 2.0f / (sim.getDT() * n);
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            float x = static_cast<float>(i) / n;
+            float y = static_cast<float>(j) / n;
+            sim.addVelocity(i, j, speed * (1.0f + 0.5f * std::sin(2 * pi * y)), speed * 0.5f * std::sin(2 * pi * x));
+            sim.addDensity(i, j, 1.0f + x);
+        }
+    }
+}
+
+struct Result
+{
+    std::string impl;
+    Kernel kernel;
+    int size;
+    float obstacleFraction;
+    int threads;
+    long long calls;
+    double seconds;
+    double nsPerCell;
+};
+
+template <class Sim>
+static Result measure(const char* impl, Kernel kernel, int size, float obstacleFraction, int threads, double minTime) {
+    std::atomic<int> ready(0);
+    std::atomic<long long> calls(0);
+    std::vector<double> elapsed(threads, 0.0);
+    std::vector<std::thread> pool;
+    const bool warmUp = static_cast<long long>(size) * size <= (1 << 20);
+
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t] {
+            // Each thread builds its own simulation so its pages are local.
+            Sim sim(size, 0.00001f, 0.0000001f, 0.2f);
+            setUp(sim, obstacleFraction);
+            if (warmUp) FluidSimBenchmark::run(sim, kernel);
+
+            ready.fetch_add(1);
+            while (ready.load() < threads) std::this_thread::yield();
+
+            auto start = std::chrono::steady_clock::now();
+            long long count = 0;
+            double seconds = 0.0;
+            do {
+                FluidSimBenchmark::run(sim, kernel);
+                count++;
+                seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while (seconds < minTime);
+            elapsed[t] = seconds;
+            calls.fetch_add(count);
+        });
+    }
+    for (std::thread& thread : pool) thread.join();
+
+    Result r;
+    r.impl = impl;
+    r.kernel = kernel;
+    r.size = size;
+    r.obstacleFraction = obstacleFraction;
+    r.threads = threads;
+    r.calls = calls.load();
+    r.seconds = *std::max_element(elapsed.begin(), elapsed.end());
+    r.nsPerCell = r.seconds * 1e9 / (static_cast<double>(r.calls) * size * size);
+    return r;
+}
+
+// A centred cube covering a fifth of the span on each axis, a swirl of a
+// few cells per step and density everywhere.
+template <class Sim>
+static void setUp3D(Sim& sim) {
+    const int n = sim.getSize();
+    const int side = n / 5;
+    const int start = (n - side) / 2;
+    for (int k = start; k < start + side; k++) {
+        for (int j = start; j < start + side; j++) {
+            for (int i = start; i < start + side; i++) sim.setObstacle(i, j, k, true);
+        }
+    }
+    const float pi = 3.14159265f;
+    const float speed = 2.0f / (sim.getDT() * n);
+    for (int k = 0; k < n; k++) {
+        for (int j = 0; j < n; j++) {
+            for (int i = 0; i < n; i++) {
+                float x = static_cast<float>(i) / n;
+                float y = static_cast<float>(j) / n;
+                float z = static_cast<float>(k) / n;
+                sim.addVelocity(i, j, k, speed * (1.0f + 0.5f * std::sin(2 * pi * y)),
+                                speed * 0.5f * std::sin(2 * pi * z), speed * 0.5f * std::sin(2 * pi * x));
+                sim.addDensity(i, j, k, 1.0f + x);
+            }
+        }
+    }
+}
+
+// One member of an ensemble seen through the FluidSim calls setUp() makes.
+struct EnsembleMember
+{
+    FluidEnsemble& ensemble;
+    int member;
+    int getSize() const { return ensemble.getSize(); }
+    float getDT() const { return ensemble.getDT(member); }
+    void setObstacle(int x, int y, bool solid) { ensemble.setObstacle(member, x, y, solid); }
+    void addVelocity(int x, int y, float amountX, float amountY) { ensemble.addVelocity(member, x, y, amountX, amountY); }
+    void addDensity(int x, int y, float amount) { ensemble.addDensity(member, x, y, amount); }
+};
+
+// The reference for an ensemble: the same number of FluidSims, one step each.
+struct FluidSimBatch
+{
+    std::vector<std::unique_ptr<FluidSim>> sims;
+    void step() {
+        for (std::unique_ptr<FluidSim>& sim : sims) sim->step();
+    }
+};
+
+// Whole steps of one solver instance; cells counts every cell it updates.
+struct SolverResult
+{
+    std::string impl;
+    int size;
+    int threads;
+    long long cells;
+    long long calls;
+    double seconds;
+    double nsPerCell;
+    double speedup;         // against the reference listed just before it
+};
+
+template <class Sim>
+static SolverResult measureSteps(const char* impl, Sim& sim, int size, int threads, long long cells, double minTime) {
+    sim.step();
+    auto start = std::chrono::steady_clock::now();
+    long long count = 0;
+    double seconds = 0.0;
+    do {
+        sim.step();
+        count++;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (seconds < minTime);
+    SolverResult r = { impl, size, threads, cells, count, seconds, seconds * 1e9 / (static_cast<double>(count) * cells), 1.0 };
+    return r;
+}
+
+template <class T>
+static std::vector<T> parseList(const char* text) {
+    std::vector<T> values;
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) values.push_back(static_cast<T>(std::atof(item.c_str())));
+    }
+    return values;
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> sizes = { 64, 128, 256, 512, 1024, 2048, 4096 };
+    std::vector<float> obstacles = { 0.0f, 0.05f, 0.2f };
+    std::vector<int> threadCounts = { 1 };
+    std::vector<int> sizes3D = { 32, 64 };
+    int members = 8;
+    int hardware = static_cast<int>(std::thread::hardware_concurrency());
+    if (hardware > 1) threadCounts.push_back(hardware);
+    double minTime = 0.2;
+    const char* outPath = nullptr;
+
+    const char* usage = " [--sizes 64,128,...] [--obstacles 0,0.05,0.2] [--threads 1,2,...]"
+                        " [--sizes-3d 32,64] [--members 8] [--min-time seconds] [--out file]";
+    for (int i = 1; i < argc; i += 2) {
+        std::string option = argv[i];
+        if (option == "--help" || option == "-h") {
+            std::cout << "Usage: " << argv[0] << usage << std::endl;
+            return 0;
+        }
+        bool known = option == "--sizes" || option == "--obstacles" || option == "--threads" ||
+                     option == "--sizes-3d" || option == "--members" || option == "--min-time" ||
+                     option == "--out";
+        if (!known || i + 1 >= argc) {
+            std::cerr << (known ? "Missing value for " : "Unknown option ") << option << std::endl;
+            std::cerr << "Usage: " << argv[0] << usage << std::endl;
+            return 1;
+        }
+        if (option == "--sizes") sizes = parseList<int>(argv[i + 1]);
+        else if (option == "--obstacles") obstacles = parseList<float>(argv[i + 1]);
+        else if (option == "--threads") threadCounts = parseList<int>(argv[i + 1]);
+        else if (option == "--sizes-3d") sizes3D = parseList<int>(argv[i + 1]);
+        else if (option == "--members") members = std::max(1, std::atoi(argv[i + 1]));
+        else if (option == "--min-time") minTime = std::atof(argv[i + 1]);
+        else outPath = argv[i + 1];
+    }
+
+    std::vector<Result> results;
+    for (int size : sizes)
+    for (float fraction : obstacles)
+    for (int threads : threadCounts)
+    for (int k = 0; k < KernelCount; k++) {
+        Kernel kernel = static_cast<Kernel>(k);
+        std::cerr << models[k].name << " " << size << "^2, obstacles " << fraction
+                  << ", " << threads << " thread(s)" << std::endl;
+        results.push_back(measure<FluidSimBaseline>("baseline", kernel, size, fraction, threads, minTime));
+        results.push_back(measure<FluidSim>("current", kernel, size, fraction, threads, minTime));
+    }
+
+    std::vector<SolverResult> solvers;
+    for (int size : sizes3D) {
+        std::cerr << "3d step " << size << "^3" << std::endl;
+        const long long cells = static_cast<long long>(size) * size * size;
+        FluidSim3DBaseline reference(size, 0.00001f, 0.0000001f, 0.2f);
+        setUp3D(reference);
+        SolverResult base = measureSteps("3d_baseline", reference, size, 1, cells, minTime);
+        solvers.push_back(base);
+        for (int threads : threadCounts) {
+            FluidSim3D sim(size, 0.00001f, 0.0000001f, 0.2f, threads);
+            setUp3D(sim);
+            SolverResult r = measureSteps("3d", sim, size, threads, cells, minTime);
+            r.speedup = base.nsPerCell / r.nsPerCell;
+            solvers.push_back(r);
+        }
+    }
+
+    const float ensembleObstacles = obstacles.empty() ? 0.0f : obstacles[0];
+    for (int size : sizes) {
+        if (size > 512) continue;
+        std::cerr << "ensemble step " << members << " x " << size << "^2" << std::endl;
+        const long long cells = static_cast<long long>(size) * size * members;
+        FluidSimBatch batch;
+        for (int m = 0; m < members; m++) {
+            batch.sims.emplace_back(new FluidSim(size, 0.00001f, 0.0000001f, 0.2f));
+            setUp(*batch.sims.back(), ensembleObstacles);
+        }
+        SolverResult base = measureSteps("fluidsim_members", batch, size, 1, cells, minTime);
+        solvers.push_back(base);
+        FluidEnsemble ensemble(size, members, 0.00001f, 0.0000001f, 0.2f);
+        for (int m = 0; m < members; m++) {
+            EnsembleMember member = { ensemble, m };
+            setUp(member, ensembleObstacles);
+        }
+        SolverResult r = measureSteps("ensemble", ensemble, size, 1, cells, minTime);
+        r.speedup = base.nsPerCell / r.nsPerCell;
+        solvers.push_back(r);
+    }
+
+    std::ofstream file;
+    if (outPath) {
+        file.open(outPath);
+        if (!file) {
+            std::cerr << "Cannot write " << outPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = outPath ? file : std::cout;
+
+    out << "{\n  \"model\": {";
+    for (int k = 0; k < KernelCount; k++) {
+        out << (k ? ", " : "") << "\"" << models[k].name << "\": { \"bytes_per_cell\": "
+            << models[k].bytesPerCell << ", \"flops_per_cell\": " << models[k].flopsPerCell << " }";
+    }
+    out << "},\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        const KernelModel& m = models[r.kernel];
+        // Results come in baseline/current pairs for the same configuration.
+        double baseline = results[i & ~size_t(1)].nsPerCell;
+        out << "    { \"impl\": \"" << r.impl << "\", \"kernel\": \"" << m.name
+            << "\", \"size\": " << r.size << ", \"obstacle_fraction\": " << r.obstacleFraction
+            << ", \"threads\": " << r.threads << ", \"calls\": " << r.calls
+            << ", \"seconds\": " << r.seconds << ", \"ns_per_cell\": " << r.nsPerCell
+            << ", \"gb_per_s\": " << m.bytesPerCell / r.nsPerCell
+            << ", \"gflop_per_s\": " << m.flopsPerCell / r.nsPerCell
+            << ", \"speedup_vs_baseline\": " << baseline / r.nsPerCell << " }"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"solvers\": [\n";
+    for (size_t i = 0; i < solvers.size(); i++) {
+        const SolverResult& r = solvers[i];
+        out << "    { \"impl\": \"" << r.impl << "\", \"size\": " << r.size
+            << ", \"threads\": " << r.threads << ", \"cells\": " << r.cells
+            << ", \"calls\": " << r.calls << ", \"seconds\": " << r.seconds
+            << ", \"ns_per_cell\": " << r.nsPerCell << ", \"speedup_vs_baseline\": " << r.speedup << " }"
+            << (i + 1 < solvers.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return 0;
+}
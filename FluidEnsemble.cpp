@@ -0,0 +1,296 @@
+#include "FluidEnsemble.h"
+#include "AlignedAlloc.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+inline int FluidEnsemble::IX(int x, int y) const {
+    x = std::max(0, std::min(x, size - 1));
+    y = std::max(0, std::min(y, size - 1));
+    return x + y * size;
+}
+
+float* FluidEnsemble::allocField() const {
+    return allocAlignedFloats(static_cast<size_t>(size) * size * lanes);
+}
+
+FluidEnsemble::FluidEnsemble(int size, int members, float diff, float visc, float timestep)
+    : size(size), members(members), lanes(paddedRowLength(members))
+{
+    diffusion = allocAlignedFloats(lanes);
+    viscosity = allocAlignedFloats(lanes);
+    dt = allocAlignedFloats(lanes);
+    coefA = allocAlignedFloats(lanes);
+    coefInv = allocAlignedFloats(lanes);
+    for (int m = 0; m < members; m++) {
+        diffusion[m] = diff;
+        viscosity[m] = visc;
+        dt[m] = timestep;
+    }
+
+    s = allocField();
+    density = allocField();
+    Vx = allocField();
+    Vy = allocField();
+    Vx0 = allocField();
+    Vy0 = allocField();
+    fluid = allocField();
+
+    // Padding lanes stay 0 so they never pick up any value.
+    for (int idx = 0; idx < size * size; idx++) {
+        std::fill(fluid + idx * lanes, fluid + idx * lanes + members, 1.0f);
+    }
+}
+
+FluidEnsemble::~FluidEnsemble() {
+    freeAlignedFloats(diffusion);
+    freeAlignedFloats(viscosity);
+    freeAlignedFloats(dt);
+    freeAlignedFloats(coefA);
+    freeAlignedFloats(coefInv);
+    freeAlignedFloats(s);
+    freeAlignedFloats(density);
+    freeAlignedFloats(Vx);
+    freeAlignedFloats(Vy);
+    freeAlignedFloats(Vx0);
+    freeAlignedFloats(Vy0);
+    freeAlignedFloats(fluid);
+}
+
+void FluidEnsemble::setParameters(int member, float diff, float visc, float timestep) {
+    if (member < 0 || member >= members) return;
+    diffusion[member] = diff;
+    viscosity[member] = visc;
+    dt[member] = timestep;
+}
+
+float FluidEnsemble::getDiffusion(int member) const {
+    return member >= 0 && member < members ? diffusion[member] : 0.0f;
+}
+
+float FluidEnsemble::getViscosity(int member) const {
+    return member >= 0 && member < members ? viscosity[member] : 0.0f;
+}
+
+float FluidEnsemble::getDT(int member) const {
+    return member >= 0 && member < members ? dt[member] : 0.0f;
+}
+
+int FluidEnsemble::getSize() const { return size; }
+int FluidEnsemble::getMemberCount() const { return members; }
+
+void FluidEnsemble::setObstacle(int member, int x, int y, bool solid) {
+    if (member < 0 || member >= members) return;
+    fluid[IX(x, y) * lanes + member] = solid ? 0.0f : 1.0f;
+}
+
+void FluidEnsemble::clearObstacles(int member) {
+    if (member < 0 || member >= members) return;
+    for (int idx = 0; idx < size * size; idx++) {
+        fluid[idx * lanes + member] = 1.0f;
+    }
+}
+
+bool FluidEnsemble::isObstacle(int member, int x, int y) const {
+    if (member < 0 || member >= members) return false;
+    return fluid[IX(x, y) * lanes + member] == 0.0f;
+}
+
+void FluidEnsemble::addDensity(int member, int x, int y, float amount) {
+    if (member >= 0 && member < members && !isObstacle(member, x, y)) {
+        density[IX(x, y) * lanes + member] += amount;
+    }
+}
+
+void FluidEnsemble::addVelocity(int member, int x, int y, float amountX, float amountY) {
+    if (member >= 0 && member < members && !isObstacle(member, x, y)) {
+        int idx = IX(x, y) * lanes + member;
+        Vx[idx] += amountX;
+        Vy[idx] += amountY;
+    }
+}
+
+void FluidEnsemble::getDensity(int member, int x, int y, float& outDensity) const {
+    outDensity = member >= 0 && member < members ? density[IX(x, y) * lanes + member] : 0.0f;
+}
+
+void FluidEnsemble::getVelocity(int member, int x, int y, float& velX, float& velY) const {
+    if (member < 0 || member >= members) {
+        velX = velY = 0.0f;
+        return;
+    }
+    int idx = IX(x, y) * lanes + member;
+    velX = Vx[idx];
+    velY = Vy[idx];
+}
+
+void FluidEnsemble::setBoundary(int b, float* x) {
+    const int n = size - 1;
+    const int L = lanes;
+    const float sx = b == 1 ? -1.0f : 1.0f;
+    const float sy = b == 2 ? -1.0f : 1.0f;
+
+    for (int i = 1; i < n; i++) {
+        float* south = x + IX(i, 0) * L;
+        float* north = x + IX(i, n) * L;
+        float* west = x + IX(0, i) * L;
+        float* east = x + IX(n, i) * L;
+        for (int m = 0; m < L; m++) {
+            south[m] = sy * south[m + size * L];
+            north[m] = sy * north[m - size * L];
+            west[m] = sx * west[m + L];
+            east[m] = sx * east[m - L];
+        }
+    }
+
+    const int corners[4][3] = {
+        { IX(0, 0), IX(1, 0), IX(0, 1) },
+        { IX(0, n), IX(1, n), IX(0, n - 1) },
+        { IX(n, 0), IX(n - 1, 0), IX(n, 1) },
+        { IX(n, n), IX(n - 1, n), IX(n, n - 1) }
+    };
+    for (const auto& c : corners) {
+        for (int m = 0; m < L; m++) {
+            x[c[0] * L + m] = 0.5f * (x[c[1] * L + m] + x[c[2] * L + m]);
+        }
+    }
+
+    const int total = size * size * L;
+    for (int k = 0; k < total; k++) {
+        x[k] *= fluid[k];
+    }
+}
+
+// Gauss-Seidel in the same row order as FluidSim; the member loop is
+// innermost, so each update is one vector operation across the batch.
+void FluidEnsemble::linearSolve(int b, float* x, float* x0) {
+    const int L = lanes;
+    const int row = size * L;
+    for (int k = 0; k < 20; k++) {
+        for (int j = 1; j < size - 1; j++) {
+            for (int i = 1; i < size - 1; i++) {
+                const int c = (i + j * size) * L;
+                for (int m = 0; m < L; m++) {
+                    float updated = (x0[c + m] + coefA[m] * (
+                        x[c + m - L] + x[c + m + L] +
+                        x[c + m - row] + x[c + m + row]
+                    )) * coefInv[m];
+                    // Obstacle cells keep their value until setBoundary zeroes them.
+                    x[c + m] += fluid[c + m] * (updated - x[c + m]);
+                }
+            }
+        }
+        setBoundary(b, x);
+    }
+}
+
+void FluidEnsemble::diffuse(int b, float* x, float* x0, const float* diff) {
+    for (int m = 0; m < lanes; m++) {
+        coefA[m] = dt[m] * diff[m] * (size - 2) * (size - 2);
+        coefInv[m] = 1.0f / (1 + 4 * coefA[m]);
+    }
+    linearSolve(b, x, x0);
+}
+
+// Each member backtraces along its own velocity, so this pass gathers per
+// member; obstacles are tested through the member's own mask.
+void FluidEnsemble::advect(int b, float* d, float* d0, float* u, float* v) {
+    const int L = lanes;
+    for (int j = 1; j < size - 1; j++) {
+        for (int i = 1; i < size - 1; i++) {
+            const int c = (i + j * size) * L;
+            for (int m = 0; m < L; m++) {
+                float dt0 = dt[m] * size;
+                float x = i - dt0 * u[c + m];
+                float y = j - dt0 * v[c + m];
+
+                if (x < 0.5f) x = 0.5f;
+                if (x > size - 1.5f) x = size - 1.5f;
+                if (y < 0.5f) y = 0.5f;
+                if (y > size - 1.5f) y = size - 1.5f;
+
+                int i0 = static_cast<int>(x);
+                int j0 = static_cast<int>(y);
+                float s1 = x - i0;
+                float s0 = 1 - s1;
+                float t1 = y - j0;
+                float t0 = 1 - t1;
+
+                int c00 = (i0 + j0 * size) * L + m;
+                int c01 = c00 + size * L;
+                float open = fluid[c + m] * fluid[c00] * fluid[c00 + L] * fluid[c01] * fluid[c01 + L];
+                d[c + m] = open * (s0 * (t0 * d0[c00] + t1 * d0[c01]) +
+                                   s1 * (t0 * d0[c00 + L] + t1 * d0[c01 + L]));
+            }
+        }
+    }
+    setBoundary(b, d);
+}
+
+void FluidEnsemble::project(float* u, float* v, float* p, float* div) {
+    const int L = lanes;
+    const int row = size * L;
+    const float h = 1.0f / size;
+    for (int j = 1; j < size - 1; j++) {
+        for (int i = 1; i < size - 1; i++) {
+            const int c = (i + j * size) * L;
+            for (int m = 0; m < L; m++) {
+                div[c + m] = fluid[c + m] * -0.5f * h * (
+                    u[c + m + L] - u[c + m - L] +
+                    v[c + m + row] - v[c + m - row]
+                );
+                p[c + m] = 0;
+            }
+        }
+    }
+    setBoundary(0, div);
+    setBoundary(0, p);
+
+    for (int m = 0; m < L; m++) {
+        coefA[m] = 1.0f;
+        coefInv[m] = 0.25f;
+    }
+    linearSolve(0, p, div);
+
+    const float g = 0.5f * size;
+    for (int j = 1; j < size - 1; j++) {
+        for (int i = 1; i < size - 1; i++) {
+            const int c = (i + j * size) * L;
+            for (int m = 0; m < L; m++) {
+                u[c + m] -= fluid[c + m] * g * (p[c + m + L] - p[c + m - L]);
+                v[c + m] -= fluid[c + m] * g * (p[c + m + row] - p[c + m - row]);
+            }
+        }
+    }
+    setBoundary(1, u);
+    setBoundary(2, v);
+}
+
+void FluidEnsemble::step() {
+    // Diffuse velocity
+    diffuse(1, Vx0, Vx, viscosity);
+    std::swap(Vx, Vx0);
+
+    diffuse(2, Vy0, Vy, viscosity);
+    std::swap(Vy, Vy0);
+
+    // Project velocity
+    project(Vx, Vy, Vx0, Vy0);
+
+    // Advect velocity
+    advect(1, Vx0, Vx, Vx, Vy);
+    advect(2, Vy0, Vy, Vx, Vy);
+    std::swap(Vx, Vx0);
+    std::swap(Vy, Vy0);
+
+    // Project again
+    project(Vx, Vy, Vx0, Vy0);
+
+    // Diffuse density
+    diffuse(0, s, density, diffusion);
+    std::swap(s, density);
+
+    // Advect density
+    advect(0, s, density, Vx, Vy);
+    std::swap(s, density);
+}
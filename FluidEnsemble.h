@@ -0,0 +1,74 @@
+#pragma once
+#ifndef FLUIDENSEMBLE_H
+#define FLUIDENSEMBLE_H
+
+// A batch of independent 2D simulations stepped together. Every field stores
+// the members of one cell side by side (member m of cell idx at
+// idx * lanes + m), with the lane count padded to the SIMD width and the
+// fields allocated aligned, so the diffuse and project sweeps run across
+// members with contiguous vector loads. Each member keeps its own obstacle
+// mask, diffusion, viscosity and dt; the scheme matches FluidSim.
+class FluidEnsemble
+{
+public:
+    FluidEnsemble(int size, int members, float diffusion, float viscosity, float dt);
+    ~FluidEnsemble();
+
+    FluidEnsemble(const FluidEnsemble&) = delete;
+    FluidEnsemble& operator=(const FluidEnsemble&) = delete;
+
+    void step();
+
+    // Members outside [0, getMemberCount()) are ignored by the setters and
+    // read as zero (and not solid) by the getters.
+    void addDensity(int member, int x, int y, float amount);
+    void addVelocity(int member, int x, int y, float amountX, float amountY);
+    void getDensity(int member, int x, int y, float& density) const;
+    void getVelocity(int member, int x, int y, float& velX, float& velY) const;
+    int getSize() const;
+    int getMemberCount() const;
+
+    // Per-member parameters; the constructor's values apply until changed.
+    void setParameters(int member, float diffusion, float viscosity, float dt);
+    float getDiffusion(int member) const;
+    float getViscosity(int member) const;
+    float getDT(int member) const;
+
+    // Obstacle support
+    void setObstacle(int member, int x, int y, bool solid);
+    void clearObstacles(int member);
+    bool isObstacle(int member, int x, int y) const;
+
+private:
+    int size;       // grid size
+    int members;    // simulations in the batch
+    int lanes;      // members padded to the SIMD width
+
+    float* diffusion;   // per lane
+    float* viscosity;
+    float* dt;          // 0 on padding lanes
+
+    float* s;       // temp density
+    float* density;
+
+    float* Vx;      // velocity x
+    float* Vy;      // velocity y
+    float* Vx0;     // temp velocity x
+    float* Vy0;     // temp velocity y
+
+    float* fluid;   // 1 for fluid cells, 0 for obstacles and padding lanes
+
+    float* coefA;   // per-lane solver coefficients for linearSolve
+    float* coefInv;
+
+    int IX(int x, int y) const;
+    float* allocField() const;
+
+    void diffuse(int b, float* x, float* x0, const float* diff);
+    void advect(int b, float* d, float* d0, float* velocX, float* velocY);
+    void project(float* velocX, float* velocY, float* p, float* div);
+    void linearSolve(int b, float* x, float* x0);
+    void setBoundary(int b, float* x);
+};
+
+#endif
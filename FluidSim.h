@@ -2,6 +2,18 @@
 #ifndef FLUIDSIM_H
 #define FLUIDSIM_H
 
+#include "PerfCounters.h"
+#include "RollingStat.h"
+#include "SlidingSpectrum.h"
+#include "SpscRing.h"
+#include "TiledField.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 class FluidSim
 {
 public:
@@ -18,33 +30,676 @@ public:
     float getViscosity() const;
     float getDT() const;
 
+    // Read-only views of the solver's own storage for bulk readers, instead
+    // of one getDensity()/getVelocity() call per cell. Cell (x, y) of a
+    // FieldView is data[y * stride + x]. The solver swaps its buffers every
+    // step, so views are only valid until the next step() or advance().
+    template <class T>
+    struct FieldView
+    {
+        const T* data;
+        int size;
+        int stride;     // elements between rows
+        T at(int x, int y) const { return data[y * stride + x]; }
+    };
+    FieldView<float> getVelocityXView() const;
+    FieldView<float> getVelocityYView() const;
+    FieldView<bool> getObstacleView() const;
+    // Pressure from the last step's final projection; p / dt is the pressure
+    // at unit density that getObstacleForce() integrates.
+    FieldView<float> getPressureView() const;
+    // Density is tiled: tile t is getDensityField().tile(t), null when empty,
+    // with rows TiledField::tileSize floats apart. get(x, y) reads any cell.
+    const TiledField& getDensityField() const;
+
+    // Bulk sources. Regions are the rectangle [x0, x1) x [y0, y1) or a mask
+    // of size * size cells, row-major, nonzero inside. Each region is kept
+    // as row spans and added in one pass; obstacle cells are skipped.
+    void addSource(int x0, int y0, int x1, int y1, float amount, float velX, float velY);
+    void addSource(const unsigned char* mask, float amount, float velX, float velY);
+    // Adds per-cell density and velocity fields (size * size, row-major,
+    // null to skip one) together in a single pass.
+    void addSourceField(const float* amount, const float* velX, const float* velY);
+
+    // Persistent sources are added at the start of every step(); amounts are
+    // per step. Returns an id for removePersistentSource().
+    int addPersistentSource(int x0, int y0, int x1, int y1, float amount, float velX, float velY);
+    int addPersistentSource(const unsigned char* mask, float amount, float velX, float velY);
+    void removePersistentSource(int id);
+    void clearPersistentSources();
+
+    // Edge conditions, applied inside the kernels. Wall reflects the normal
+    // velocity. Inflow imposes velocity and density on the edge cells k in
+    // [from, to) (to = -1 for the whole edge) and is a wall elsewhere.
+    // Outflow is zero-gradient with zero pressure, so the wake leaves the
+    // domain. Periodic wraps to the opposite edge and always comes in pairs.
+    // Fixed leaves the edge ring to the caller, as on a fine patch. Edges
+    // start as walls.
+    enum Edge
+    {
+        EdgeLeft,       // x = 0
+        EdgeRight,      // x = size - 1
+        EdgeBottom,     // y = 0
+        EdgeTop,        // y = size - 1
+        EdgeCount
+    };
+    enum class BoundaryType
+    {
+        Wall,
+        Inflow,
+        Outflow,
+        Periodic,
+        Fixed
+    };
+    void setBoundaryType(Edge edge, BoundaryType type);
+    void setInflow(Edge edge, float velX, float velY, float density, int from = 0, int to = -1);
+    BoundaryType getBoundaryType(Edge edge) const;
+
     // Obstacle support
     void setObstacle(int x, int y, bool solid);
     void clearObstacles();
     bool isObstacle(int x, int y) const;
 
+    // Bulk obstacle setters mark the covered cells solid, tagged with a body
+    // id (0 for anonymous walls, up to 255) for per-body queries. Shapes are
+    // in cell units and cover the cells whose centres (i, j) lie inside
+    // (half-open on the right and top), found with a scanline rasterizer. The mask is size * size, row-major,
+    // nonzero for solid. The airfoil is a NACA 4-digit section (e.g. 2412)
+    // with its leading edge at (x, y), pitched nose up by angle degrees
+    // about the leading edge for flow along +x.
+    void setObstacleMask(const unsigned char* mask, int body = 0);
+    void setObstacleRect(int x0, int y0, int x1, int y1, int body = 0);
+    void setObstacleCircle(float cx, float cy, float radius, int body = 0);
+    void setObstaclePolygon(const float* xy, int count, int body = 0);
+    void setObstacleAirfoil(int naca, float x, float y, float chord, float angle, int body = 0);
+    int getObstacleBody(int x, int y) const;    // -1 for fluid cells
+
+    // Cut cells. When enabled, the shape setters also record the signed
+    // distance to the body at cell corners, and commitObstacles() derives
+    // the open fraction of every cell face from it. Diffusion, projection
+    // and advection then weight their stencils by these face apertures, and
+    // getObstacleForce() integrates pressure over the closed face parts, so
+    // curved bodies are no longer staircases. Cells inside a shape and less
+    // than minFraction open are solid; cells outside every shape stay fluid.
+    // setObstacle(), rects and masks stay binary: they close the faces they
+    // share with fluid cells and leave the corner distances alone. Enable
+    // before adding obstacles; existing static obstacles become binary.
+    // Calling again with only a new minFraction re-applies it.
+    void setCutCells(bool enabled, float minFraction = 0.05f);
+    bool getCutCells() const;
+    // Adds a body given as a signed distance in cells (negative inside)
+    // sampled at the cell centres, size * size, row-major.
+    void setObstacleDistance(const float* distance, int body = 0);
+    float getCellFraction(int x, int y) const;     // 1 open, 0 solid
+
+    // Moving bodies: an outline in the body's own frame placed by a pose
+    // (position in cells, angle in degrees nose up as for the airfoil) and
+    // advanced by the body's velocity after every step. The body's solid
+    // cells hold its rigid velocity, which neighbouring fluid cells see as
+    // the wall velocity in diffusion, projection and advection. A step only
+    // re-rasterizes bodies whose pose or outline changed and only touches
+    // the cells swept since the last step, rebuilding the derived obstacle
+    // structures of their tiles. With cut cells the corner distances are
+    // also rewritten in a band two cells wide around the old and new
+    // outlines, at a cost of band corners times outline vertices. Velocities are in getVelocity() units,
+    // angular velocity in degrees per unit time. Moving bodies share the
+    // body ids of the bulk setters and should not overlap static obstacles;
+    // id 0 is kept for plain walls, so ids outside 1..255 are ignored.
+    void addMovingBody(int body, const float* xy, int count, float x, float y, float angle = 0.0f);
+    void addMovingCircle(int body, float x, float y, float radius);
+    void addMovingAirfoil(int body, int naca, float x, float y, float chord, float angle);
+    void setBodyShape(int body, const float* xy, int count);     // deforms the outline
+    void setBodyPose(int body, float x, float y, float angle);
+    void setBodyVelocity(int body, float velX, float velY, float angularVelocity);
+    bool getBodyPose(int body, float& x, float& y, float& angle) const;     // false if not moving
+    void removeMovingBody(int body);
+
+    // Rebuilds the derived obstacle structures (solid and surface cell lists
+    // per tile, cut-cell apertures) for the tiles edited since the last
+    // commit. step() commits pending edits itself; call it to pay the cost
+    // up front.
+    void commitObstacles();
+
+    // Pressure force on the obstacle cells inside [x0, x1) x [y0, y1) from the
+    // last step's final projection (pressure p / dt at unit density, face
+    // length 1 / size). Positive x is downstream for the usual inflow. With
+    // cut cells the box should cover the body; the open cells around it are
+    // included. Pressure only; getBodyForce() adds the viscous part.
+    void getObstacleForce(int x0, int y0, int x1, int y1, float& forceX, float& forceY) const;
+
+    // Force on each body id from the last step, integrated by the final
+    // projection over the faces between the body's surface cells and fluid:
+    // pressure p / dt as for getObstacleForce(), plus viscous shear from the
+    // tangential velocity difference between fluid and wall across each face.
+    // With cut cells, the closed face parts within two cells of the body's
+    // surface count too, so bodies closer than that share them. Zero for ids
+    // without surface cells.
+    struct BodyForce
+    {
+        float x, y;             // total; x is drag, y lift for flow along +x
+        float pressureX, pressureY;
+        float viscousX, viscousY;
+    };
+    BodyForce getBodyForce(int body) const;
+
+    // Probes are points in cell units sampled bilinearly at the end of every
+    // step(), one ProbeSample per probe, into a lock-free ring preallocated
+    // for capacity steps. The solver thread is the producer; one consumer
+    // thread may drain it with popProbeSample() while steps run. Samples
+    // that find the ring full are dropped and counted. Adding probes or
+    // changing the capacity reallocates the ring, so do it while no consumer
+    // is draining. Pressure is p / dt, as for getObstacleForce().
+    struct ProbeSample
+    {
+        long long step;         // steps completed, counting this one
+        double time;            // simulated time at the end of the step
+        int probe;
+        float velX;
+        float velY;
+        float pressure;
+        float density;
+    };
+    int addProbe(float x, float y);     // returns the probe index
+    void clearProbes();
+    int getProbeCount() const;
+    void setProbeCapacity(int steps);
+    bool popProbeSample(ProbeSample& sample);
+    long long getDroppedProbeSamples() const;
+    double getTime() const;             // simulated time of all steps so far
+
+    // Spectral estimators on probe signals, fed on the solver thread as the
+    // probe is sampled (see SlidingSpectrum), e.g. the cross-stream velocity
+    // in a wake for the shedding frequency. The sample interval is the dt
+    // when the estimator is added; under an adaptive dt the probe signal is
+    // resampled onto that interval by linear interpolation between steps, so
+    // frequencies stay per unit simulated time. Each sample costs one update
+    // per bin in [minFrequency, maxFrequency], so keep the band narrow for
+    // long windows. Returns -1 for an unknown probe. References stay valid
+    // until the next addProbeSpectrum() or clearProbes().
+    enum class ProbeSignal
+    {
+        VelocityX,
+        VelocityY,
+        Pressure,
+        Density
+    };
+    int addProbeSpectrum(int probe, ProbeSignal signal, int window, float minFrequency,
+        float maxFrequency, float tolerance = 0.01f);
+    const SlidingSpectrum& getProbeSpectrum(int spectrum) const;
+
+    // Running statistics of velocity, pressure (p / dt) and density: per-cell
+    // mean and M2, the sum of squared deviations, each sample weighted by its
+    // step's dt so the means are time averages under an adaptive dt
+    // (variance is M2 / weight). Updated with weighted Welford steps where
+    // step() last writes each field: velocity and pressure in the final
+    // projection, density in the pass that retires empty tiles; with a fine
+    // patch both are taken after the patch is restricted onto the grid.
+    // Empty density tiles are caught up in closed form when next touched or
+    // read. With window > 0 the statistics restart every window steps and the
+    // completed window stays readable; 0 keeps accumulating until
+    // resetFieldStats(). The velocity edge ring is not sampled. Views follow
+    // the FieldView rules.
+    struct FieldStats
+    {
+        long long samples;
+        double weight;      // summed dt of the samples
+        FieldView<float> meanX, m2X;
+        FieldView<float> meanY, m2Y;
+        FieldView<float> meanPressure, m2Pressure;
+        FieldView<float> meanDensity, m2Density;
+    };
+    void setFieldStats(bool enabled, int window = 0);
+    void resetFieldStats();
+    FieldStats getFieldStats();                     // current window so far
+    FieldStats getCompletedFieldStats() const;      // last full window, no samples if none
+
+    // Sparse density: only tiles holding density (or receiving it this step)
+    // are allocated and processed. Tiles whose density drops to the threshold
+    // or below are released.
+    void setDensityThreshold(float threshold);
+    int getActiveDensityTiles() const;
+
+    // Quiescent tiles: a tile whose velocity changed by less than threshold
+    // over the last step, with quiet neighbours, is put to sleep and skipped
+    // by the velocity kernels until activity next to it wakes it up.
+    struct QuiescenceStats
+    {
+        int awakeTiles;
+        int sleepingTiles;
+        int sleepingCells;      // interior cells skipped by every velocity pass
+        float maxSleepDelta;    // largest last-measured change among sleeping tiles
+        float seamDivergence;   // max |div| along sleeping tile borders after projection
+    };
+    void setQuiescence(bool enabled, float threshold = 1e-4f);
+    QuiescenceStats getQuiescenceStats() const;
+
+    // Static fine patch over extent x extent coarse cells at (x, y), simulated
+    // ratio times finer on a worker thread that lives as long as the patch.
+    // Each step its edge ring is fed from the coarse grid and its interior is
+    // averaged back into the cells it covers. Obstacles are copied from the
+    // coarse grid; refine them through getFinePatch() for a smoother body.
+    // The patch follows the advection scheme and the channels, which are fed
+    // and averaged like density.
+    void setFinePatch(int x, int y, int extent, int ratio);
+    void clearFinePatch();
+    FluidSim* getFinePatch() const;
+
+    // Adaptive timestep: advance(frameTime) substeps until frameTime is
+    // covered. With adaptive mode on, each substep's dt is the largest that
+    // keeps the fastest cell within targetCFL cells, capped by the
+    // constructor's dt; otherwise the constructor's dt is used throughout.
+    // The bound counts velocity added since the last step, the push of
+    // persistent sources and a fine patch's speed in its own cells. No
+    // substep exceeds the bound: once maxSubsteps are taken advance() stops
+    // and reports the frame time it left uncovered.
+    struct StepReport
+    {
+        int substeps;
+        float dtMin;
+        float dtMax;
+        float maxSpeed;     // largest velocity component after the last substep
+        float uncovered;    // frame time not stepped because of the substep limit
+    };
+    void setAdaptiveTimestep(bool enabled, float targetCFL = 1.0f, int maxSubsteps = 32);
+    StepReport advance(float frameTime);
+    StepReport getLastStepReport() const;
+    float getMaxSpeed() const;
+
+    // Advection scheme for velocity and density. MacCormack and BFECC are
+    // second order: the corrected value is clamped to the forward stencil,
+    // and cells whose stencils touch an obstacle keep the first-order value.
+    enum class AdvectionScheme
+    {
+        SemiLagrangian,
+        MacCormack,
+        BFECC
+    };
+    void setAdvectionScheme(AdvectionScheme scheme);
+    AdvectionScheme getAdvectionScheme() const;
+
+    // Named passive scalars (colours, temperature, age of air) carried by the
+    // velocity field. All channels are diffused and semi-Lagrangian advected
+    // together, so each cell's stencil and bilinear weights are computed
+    // once. Interleaved keeps a cell's channels adjacent; Planar stores one
+    // plane per channel. Changing the layout keeps the stored values.
+    enum class ChannelLayout
+    {
+        Interleaved,
+        Planar
+    };
+    void setChannelLayout(ChannelLayout layout);
+    ChannelLayout getChannelLayout() const;
+    int addChannel(const std::string& name, float diffusion);
+    int findChannel(const std::string& name) const;    // -1 if missing
+    int getChannelCount() const;
+    void addChannelValue(int channel, int x, int y, float amount);
+    float getChannelValue(int channel, int x, int y) const;
+
+    // Per-phase instrumentation, compiled out with FLUIDSIM_NO_STATS and off
+    // until enabled. Each phase records wall time, solver iterations (passes
+    // for advection), the final Gauss-Seidel residual (largest change one
+    // more sweep would make) and the interior cells visited. Times and
+    // residuals are reported as the last value plus the mean and maximum over
+    // the last RollingStat::window steps.
+    enum Phase
+    {
+        PhaseDiffuseVelocity,
+        PhaseProject,
+        PhaseAdvectVelocity,
+        PhaseReproject,
+        PhaseDiffuseDensity,
+        PhaseAdvectDensity,
+        PhaseChannels,
+        PhaseCount
+    };
+    struct PhaseStats
+    {
+        const char* name;
+        float lastMs;
+        float meanMs;
+        float maxMs;
+        int iterations;
+        float residual;
+        float meanResidual;
+        float maxResidual;
+        long long cells;
+        unsigned long long counters[PerfCounters::CounterCount];   // last step, 0 if not counted
+    };
+    struct Stats
+    {
+        bool enabled;
+        long long steps;        // steps recorded since stats were enabled
+        float lastStepMs;
+        float meanStepMs;
+        float maxStepMs;
+        PhaseStats phases[PhaseCount];
+        QuiescenceStats quiescence;
+        int activeDensityTiles;
+        bool countersAvailable;
+        bool counting[PerfCounters::CounterCount];
+    };
+    void setStatsEnabled(bool enabled);
+    Stats getStats() const;
+    static const char* getPhaseName(int phase);
+
+    // Hardware counters (cycles, instructions, LLC and dTLB misses, stalled
+    // cycles) read around each phase while stats are enabled. They count
+    // the thread that calls step(). Returns false where perf_event_open is
+    // unavailable; the phases then report zeros.
+    bool setHardwareCounters(bool enabled);
+
 private:
+    friend class FluidSimBenchmark;
+
     int size;       // grid size
     float dt;       // timestep
     float diffusion;
     float viscosity;
+    float gridScale;        // cells per unit length: size, or size * ratio on a fine patch
 
-    float* s;       // temp density
-    float* density;
+    struct EdgeCondition
+    {
+        BoundaryType type;
+        float velX;
+        float velY;
+        float density;
+        int from, to;       // inflow cells along the edge
+    };
+    EdgeCondition edges[EdgeCount];
+    // Rings of the Fixed edges as the caller left them before step(), cell k
+    // of edge e at e * size + k (times the channel count for channels). The
+    // kernels write them back into every buffer they fill.
+    std::vector<float> fixedVelX, fixedVelY, fixedDensity, fixedChannels;
+    bool periodicX;         // backtraces wrap across periodic edge pairs
+    bool periodicY;
+
+    // Edge ring cell k of an edge is (x + k * alongX, y + k * alongY); the
+    // interior cell next to it is one (inX, inY) step inward.
+    struct EdgeLayout
+    {
+        int x, y;
+        int alongX, alongY;
+        int inX, inY;
+    };
+
+    TiledField* s;       // temp density
+    TiledField* density;
 
     float* Vx;      // velocity x
     float* Vy;      // velocity y
     float* Vx0;     // temp velocity x
     float* Vy0;     // temp velocity y
+    float pressureDt;       // dt of the projection whose pressure Vx0 holds
+    BodyForce bodyForces[256];      // per body id, from the final projection
+    long long stepCount;
+    double simTime;
+
+    // Probe corners are idx, idx + 1, idx + size, idx + 1 + size.
+    struct Probe
+    {
+        float x, y;
+        int idx;
+        float w[4];
+    };
+    std::vector<Probe> probes;
+    SpscRing<ProbeSample>* probeRing;
+    int probeSteps;                 // ring capacity in steps
+    std::atomic<long long> probeDropped;
+    struct ProbeSpectrum
+    {
+        int probe;
+        ProbeSignal signal;
+        SlidingSpectrum estimator;
+        double nextTime;        // time of the next sample on the fixed interval
+        double lastTime;        // previous step's time and signal value
+        float lastValue;
+    };
+    std::vector<ProbeSpectrum> probeSpectra;
+
+    // Field statistics: mean and M2 planes of size * size floats for x and y
+    // velocity, pressure and density, in that order.
+    bool fieldStatsOn;
+    int fieldWindow;
+    long long fieldSamples;         // samples in the current set, this step's included
+    long long completedSamples;
+    double fieldWeight;             // summed dt of the current set, this step's included
+    double completedWeight;
+    float* fieldCurrent;
+    float* fieldCompleted;          // last full window
+    double* densityWeight;          // per tile: weight folded into its density statistics
 
     bool* obstacles; // obstacle grid
+    unsigned char* obstacleBody;    // body id of solid cells
+    // How the setters last marked a cell. Walls are binary; with cut cells
+    // shape cells are solid only while nearly covered by their shape.
+    enum class CellKind : unsigned char
+    {
+        Open,
+        Wall,       // setObstacle, rects and masks
+        Shape,      // circles, polygons and distance fields
+        Moving      // a moving body; holds its wall velocity
+    };
+    CellKind* cellKind;
+
+    // Derived from obstacles by commitObstacles(), per tile and flattened.
+    // Surface cells are solid cells with an open 4-neighbour; with cut
+    // cells, wetted cells are fluid cells with a closed face part.
+    bool obstaclesDirty;
+    bool* obstacleTileDirty;
+    std::vector<std::vector<int>> tileSolids;
+    std::vector<std::vector<int>> tileSurfaces;
+    std::vector<std::vector<int>> tileWetted;
+    std::vector<int> solidCells;
+    std::vector<int> surfaceCells;  // ascending
+    std::vector<int> wettedCells;
+
+    bool cutCells;
+    float cutMinFraction;
+    float* cornerDistance;  // (size + 1)^2, corner (i, j) at (i - 0.5, j - 0.5)
+    float* faceX;           // open fraction of the face between (i, j) and (i + 1, j)
+    float* faceY;           // open fraction of the face between (i, j) and (i, j + 1)
+    float* cellFraction;    // mean of the four face apertures, 0 in solid cells
+
+    // Cells [x0, x1) of row y; regions and rasterized shapes are span lists.
+    struct CellSpan
+    {
+        int y, x0, x1;
+    };
+    struct PersistentSource
+    {
+        int id;
+        std::vector<CellSpan> spans;
+        float amount;
+        float velX;
+        float velY;
+    };
+    std::vector<PersistentSource> persistentSources;
+    int nextSourceId;
+
+    // spans are the cells covered at the last rasterization.
+    struct MovingBody
+    {
+        int body;
+        std::vector<float> outline;     // body frame, empty for a circle
+        float radius;
+        float x, y, angle;
+        float velX, velY, spin;
+        bool moved;                     // pose or outline changed since rasterized
+        std::vector<CellSpan> spans;
+    };
+    std::vector<MovingBody> movingBodies;
+    int bodySlot[256];      // movingBodies index per body id, -1 if not moving
+
+    int tilesPerRow;
+    bool* densityActive;            // per tile: holds or receives density
+    std::vector<int> densityTiles;  // active tiles for the current step
+    float* tileSpeed;               // per tile: largest velocity component, from project()
+    int* activeSum;                 // summed-area table of densityActive
+    float densityThreshold;
+
+    bool quiescence;
+    float quiescenceThreshold;
+    bool* velocityAsleep;           // per tile: skipped by the velocity kernels
+    float* tileDelta;               // per tile: largest velocity change last step
+    float* VxPrev;                  // velocity after the previous step (quiescence only)
+    float* VyPrev;
+    std::vector<int> velocityTiles; // awake tiles visited by the velocity kernels
+    QuiescenceStats quiescenceStats;
+
+    FluidSim* patch;
+    int patchX;
+    int patchY;
+    int patchExtent;
+    int patchRatio;
+    std::thread patchWorker;        // steps the patch while step() runs the coarse grid
+    std::mutex patchMutex;
+    std::condition_variable patchSignal;
+    bool patchPending;              // a patch step is requested and not yet finished
+    bool patchStop;
+
+    float maxDt;            // dt given at construction, upper bound for advance()
+    bool adaptive;
+    float cflTarget;
+    int substepLimit;
+    StepReport lastReport;
+
+    bool statsEnabled;
+    long long statsSteps;
+    RollingStat stepTime;
+    RollingStat phaseTime[PhaseCount];
+    RollingStat phaseResidual[PhaseCount];
+    int phaseIterations[PhaseCount];
+    long long phaseCells[PhaseCount];
+    int pendingIterations;          // filled in by the kernels of the open phase
+    float pendingResidual;
+
+    bool countersRequested;
+    PerfCounters* perf;
+    std::thread::id perfThread;     // counters follow the thread that opened them
+    unsigned long long phaseCounters[PhaseCount][PerfCounters::CounterCount];
+
+    // Times one phase of stepGrid() and commits what its kernels reported.
+    struct PhaseScope
+    {
+        PhaseScope(FluidSim& sim, Phase phase);
+        ~PhaseScope();
+        FluidSim& sim;
+        Phase phase;
+        long long start;
+        unsigned long long counterStart[PerfCounters::CounterCount];
+    };
+
+    AdvectionScheme advectionScheme;
+    float* advectU;             // reverse-trace scratch (MacCormack / BFECC)
+    float* advectV;
+    TiledField* densityScratch;
+
+    ChannelLayout channelLayout;
+    std::vector<std::string> channelNames;
+    std::vector<float> channelDiffusion;
+    float* channels;        // channel c of cell idx at idx * cellStride + c * planeStride
+    float* channels0;       // temp channels
+    int cellStride;
+    int planeStride;
+
+    // Clamped backtrace position and its bilinear weights. With cut cells,
+    // w holds the corner weights scaled by the corners' open fractions and
+    // renormalised (corners c, c + 1, c + size, c + 1 + size).
+    struct Backtrace
+    {
+        int i0, j0;
+        float s1, t1;
+        float w[4];
+    };
 
     int IX(int x, int y) const;
+    void tileBounds(int t, int& x0, int& x1, int& y0, int& y1) const;
+    void interiorBounds(int t, int& x0, int& x1, int& y0, int& y1) const;
 
     void diffuse(int b, float* x, float* x0, float diff);
-    void advect(int b, float* d, float* d0, float* velocX, float* velocY);
-    void project(float* velocX, float* velocY, float* p, float* div);
+    bool backtrace(float x, float y, Backtrace& bt) const;
+    float interpolate(const float* f, const Backtrace& bt) const;
+    float interpolate(const TiledField* f, const Backtrace& bt) const;
+    float limit(float value, const float* f, const Backtrace& bt) const;
+    float limit(float value, const TiledField* f, const Backtrace& bt) const;
+    void advectVelocity(float* du, float* dv, float* velocX, float* velocY);
+    void project(float* velocX, float* velocY, float* p, float* div, bool last = false);
+    void projectCut(float* velocX, float* velocY, float* p, float* div, bool last);
+    void integrateForces(const float* u, const float* v, const float* p);
+    void raiseTileSpeed(int x, int y, float speed);
+    float cellSpeed() const;
+    int faceBody(int a, int b, int side) const;
+    EdgeLayout edgeLayout(int edge) const;
+    bool isImposedEdge(int edge, int b) const;
+    void captureFixedEdges();
+    void fillEdges(int b, float* x, int stride);
     void setBoundary(int b, float* x);
+    void stepGrid();
+    long long countCells(const std::vector<int>& tiles) const;
+    float solveResidual(const float* x, const float* x0, float a, float c) const;
+    float solveResidual(const TiledField* x, const TiledField* x0, float a, float c) const;
+
+    void rectSpans(int x0, int y0, int x1, int y1, std::vector<CellSpan>& spans) const;
+    void maskSpans(const unsigned char* mask, std::vector<CellSpan>& spans) const;
+    void applySource(const std::vector<CellSpan>& spans, float amount, float velX, float velY);
+    void circleSpans(float cx, float cy, float radius, std::vector<CellSpan>& spans) const;
+    void polygonSpans(const float* xy, int count, std::vector<CellSpan>& spans) const;
+    void markObstacles(const std::vector<CellSpan>& spans, int body, CellKind kind);
+    void openObstacles(const std::vector<CellSpan>& spans, int body);
+    void subtractSpans(const std::vector<CellSpan>& a, const std::vector<CellSpan>& b,
+        std::vector<CellSpan>& out) const;
+    void mergeSpans(std::vector<CellSpan>& spans) const;
+    void outlineBand(const std::vector<CellSpan>& spans, std::vector<CellSpan>& band) const;
+    void rasterizeBody(MovingBody& m);
+    void updateBodies();
+    void advanceBodies();
+    float wallVelocity(int b, int idx) const;
+    void invalidateObstacles();
+    void rebuildObstacleTile(int t);
+    void reopenCorners(const std::vector<CellSpan>& spans, int body);
+    void shapeCorners(const std::vector<CellSpan>& spans, const float* xy, int count,
+        float cx, float cy, float radius);
+    void cornerDistances(float x0, float y0, float x1, float y1, const float* xy, int count,
+        float cx, float cy, float radius);
+    float shapeDistance(float px, float py, const float* xy, int count, float cx, float cy, float radius) const;
+    float aperture(int cornerA, int cornerB) const;
+    void updateCutFractions(int t);
+    void updateCutFaces(int t);
+    bool cutWeights(Backtrace& bt) const;
+
+    void wakeTile(int x, int y);
+    void rebuildVelocityTiles();
+    void copySleepingTiles(float* dst, const float* src);
+    void updateQuiescence();
+
+    void activateDensityTile(int t);
+    void updateDensityTiles();
+    void wrapDensityTiles(int a, int b);
+    void retireDensityTiles();
+    void diffuseDensity(TiledField* x, TiledField* x0, float diff);
+    void advectDensity(TiledField* d, TiledField* d0, float* velocX, float* velocY);
+
+    void resizeChannels(int count, ChannelLayout layout);
+    void setChannelBoundary(float* x);
+    void diffuseChannels(float* x, float* x0);
+    void advectChannels(float* d, float* d0, float* velocX, float* velocY);
+    void setDensityBoundary(TiledField* x);
+
+    float sampleField(const float* f, float x, float y, int stride = 1) const;
+    float sampleDensity(float x, float y) const;
+    void setDensityCell(int x, int y, float value);
+    void accumulateFlow(int idx, float u, float v, float p);
+    void accumulateSleepingFlow(const float* u, const float* v, const float* p);
+    void accumulateDensityTile(int t, const float* cells);
+    void catchUpDensityTile(int t, double weight);
+    void accumulatePatchedFields();
+    void completeFieldWindow();
+    FieldStats fieldStatsView(const float* planes, long long samples, double weight) const;
+    void resetProbeRing();
+    void sampleProbes();
+    void feedPatch(bool interior);
+    void restrictPatch();
+    void patchLoop();
 };
 
 #endif
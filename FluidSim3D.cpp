@@ -0,0 +1,311 @@
+#include "FluidSim3D.h"
+#include "AlignedAlloc.h"
+#include <algorithm>
+#include <cmath>
+
+inline int FluidSim3D::IX(int x, int y, int z) const {
+    x = std::max(0, std::min(x, size - 1));
+    y = std::max(0, std::min(y, size - 1));
+    z = std::max(0, std::min(z, size - 1));
+    return x + y * pitch + z * slice;
+}
+
+float* FluidSim3D::allocField() const {
+    return allocAlignedFloats(static_cast<size_t>(slice) * size);
+}
+
+FluidSim3D::FluidSim3D(int size, float diffusion, float viscosity, float dt, int threads)
+    : size(size), pitch(paddedRowLength(size)), slice(paddedRowLength(size) * size),
+      dt(dt), diffusion(diffusion), viscosity(viscosity), pool(threads)
+{
+    s = allocField();
+    density = allocField();
+    Vx = allocField();
+    Vy = allocField();
+    Vz = allocField();
+    Vx0 = allocField();
+    Vy0 = allocField();
+    Vz0 = allocField();
+    fluid = allocField();
+
+    // Padding columns stay 0 so they never contribute to any stencil.
+    for (int z = 0; z < size; z++) {
+        for (int y = 0; y < size; y++) {
+            std::fill(fluid + z * slice + y * pitch, fluid + z * slice + y * pitch + size, 1.0f);
+        }
+    }
+}
+
+FluidSim3D::~FluidSim3D() {
+    freeAlignedFloats(s);
+    freeAlignedFloats(density);
+    freeAlignedFloats(Vx);
+    freeAlignedFloats(Vy);
+    freeAlignedFloats(Vz);
+    freeAlignedFloats(Vx0);
+    freeAlignedFloats(Vy0);
+    freeAlignedFloats(Vz0);
+    freeAlignedFloats(fluid);
+}
+
+void FluidSim3D::setObstacle(int x, int y, int z, bool solid) {
+    fluid[IX(x, y, z)] = solid ? 0.0f : 1.0f;
+}
+
+void FluidSim3D::clearObstacles() {
+    for (int z = 0; z < size; z++) {
+        for (int y = 0; y < size; y++) {
+            std::fill(fluid + z * slice + y * pitch, fluid + z * slice + y * pitch + size, 1.0f);
+        }
+    }
+}
+
+bool FluidSim3D::isObstacle(int x, int y, int z) const {
+    return fluid[IX(x, y, z)] == 0.0f;
+}
+
+void FluidSim3D::addDensity(int x, int y, int z, float amount) {
+    if (!isObstacle(x, y, z)) {
+        density[IX(x, y, z)] += amount;
+    }
+}
+
+void FluidSim3D::addVelocity(int x, int y, int z, float amountX, float amountY, float amountZ) {
+    if (!isObstacle(x, y, z)) {
+        int idx = IX(x, y, z);
+        Vx[idx] += amountX;
+        Vy[idx] += amountY;
+        Vz[idx] += amountZ;
+    }
+}
+
+void FluidSim3D::getDensity(int x, int y, int z, float& outDensity) const {
+    outDensity = density[IX(x, y, z)];
+}
+
+void FluidSim3D::getVelocity(int x, int y, int z, float& velX, float& velY, float& velZ) const {
+    int idx = IX(x, y, z);
+    velX = Vx[idx];
+    velY = Vy[idx];
+    velZ = Vz[idx];
+}
+
+int FluidSim3D::getSize() const { return size; }
+float FluidSim3D::getDiffusion() const { return diffusion; }
+float FluidSim3D::getViscosity() const { return viscosity; }
+float FluidSim3D::getDT() const { return dt; }
+
+// b is the velocity component the walls negate: 1 = x, 2 = y, 3 = z, and
+// 0 mirrors a scalar unchanged.
+void FluidSim3D::setBoundary(int b, float* x) {
+    const int n = size - 1;
+
+    // Faces: mirror the first interior layer, negating the normal component.
+    pool.parallelFor(1, n, [&](int lo, int hi) {
+        for (int j = lo; j < hi; j++) {
+            for (int i = 1; i < n; i++) {
+                x[i + j * pitch] = b == 3 ? -x[i + j * pitch + slice] : x[i + j * pitch + slice];
+                x[i + j * pitch + n * slice] = b == 3 ? -x[i + j * pitch + (n - 1) * slice] : x[i + j * pitch + (n - 1) * slice];
+
+                x[i + j * slice] = b == 2 ? -x[i + pitch + j * slice] : x[i + pitch + j * slice];
+                x[i + n * pitch + j * slice] = b == 2 ? -x[i + (n - 1) * pitch + j * slice] : x[i + (n - 1) * pitch + j * slice];
+
+                x[i * pitch + j * slice] = b == 1 ? -x[1 + i * pitch + j * slice] : x[1 + i * pitch + j * slice];
+                x[n + i * pitch + j * slice] = b == 1 ? -x[n - 1 + i * pitch + j * slice] : x[n - 1 + i * pitch + j * slice];
+            }
+        }
+    });
+
+    // Edges average their two face neighbours, corners their three.
+    for (int i = 1; i < n; i++) {
+        x[IX(i, 0, 0)] = 0.5f * (x[IX(i, 1, 0)] + x[IX(i, 0, 1)]);
+        x[IX(i, n, 0)] = 0.5f * (x[IX(i, n - 1, 0)] + x[IX(i, n, 1)]);
+        x[IX(i, 0, n)] = 0.5f * (x[IX(i, 1, n)] + x[IX(i, 0, n - 1)]);
+        x[IX(i, n, n)] = 0.5f * (x[IX(i, n - 1, n)] + x[IX(i, n, n - 1)]);
+
+        x[IX(0, i, 0)] = 0.5f * (x[IX(1, i, 0)] + x[IX(0, i, 1)]);
+        x[IX(n, i, 0)] = 0.5f * (x[IX(n - 1, i, 0)] + x[IX(n, i, 1)]);
+        x[IX(0, i, n)] = 0.5f * (x[IX(1, i, n)] + x[IX(0, i, n - 1)]);
+        x[IX(n, i, n)] = 0.5f * (x[IX(n - 1, i, n)] + x[IX(n, i, n - 1)]);
+
+        x[IX(0, 0, i)] = 0.5f * (x[IX(1, 0, i)] + x[IX(0, 1, i)]);
+        x[IX(n, 0, i)] = 0.5f * (x[IX(n - 1, 0, i)] + x[IX(n, 1, i)]);
+        x[IX(0, n, i)] = 0.5f * (x[IX(1, n, i)] + x[IX(0, n - 1, i)]);
+        x[IX(n, n, i)] = 0.5f * (x[IX(n - 1, n, i)] + x[IX(n, n - 1, i)]);
+    }
+
+    const float third = 1.0f / 3.0f;
+    x[IX(0, 0, 0)] = third * (x[IX(1, 0, 0)] + x[IX(0, 1, 0)] + x[IX(0, 0, 1)]);
+    x[IX(n, 0, 0)] = third * (x[IX(n - 1, 0, 0)] + x[IX(n, 1, 0)] + x[IX(n, 0, 1)]);
+    x[IX(0, n, 0)] = third * (x[IX(1, n, 0)] + x[IX(0, n - 1, 0)] + x[IX(0, n, 1)]);
+    x[IX(n, n, 0)] = third * (x[IX(n - 1, n, 0)] + x[IX(n, n - 1, 0)] + x[IX(n, n, 1)]);
+    x[IX(0, 0, n)] = third * (x[IX(1, 0, n)] + x[IX(0, 1, n)] + x[IX(0, 0, n - 1)]);
+    x[IX(n, 0, n)] = third * (x[IX(n - 1, 0, n)] + x[IX(n, 1, n)] + x[IX(n, 0, n - 1)]);
+    x[IX(0, n, n)] = third * (x[IX(1, n, n)] + x[IX(0, n - 1, n)] + x[IX(0, n, n - 1)]);
+    x[IX(n, n, n)] = third * (x[IX(n - 1, n, n)] + x[IX(n, n - 1, n)] + x[IX(n, n, n - 1)]);
+
+    // Zero obstacle voxels with a straight multiply over each slab.
+    pool.parallelFor(0, size, [&](int lo, int hi) {
+        float* xs = x + static_cast<size_t>(lo) * slice;
+        const float* fs = fluid + static_cast<size_t>(lo) * slice;
+        const int count = (hi - lo) * slice;
+        for (int idx = 0; idx < count; idx++) {
+            xs[idx] *= fs[idx];
+        }
+    });
+}
+
+// Red-black Gauss-Seidel: cells of one colour only read the other colour, so
+// each half-sweep can be split across threads without changing the result.
+void FluidSim3D::linearSolve(int b, float* x, float* x0, float a, float c) {
+    const float invC = 1.0f / c;
+    for (int k = 0; k < 20; k++) {
+        for (int color = 0; color < 2; color++) {
+            pool.parallelFor(1, size - 1, [&](int lo, int hi) {
+                for (int z = lo; z < hi; z++) {
+                    for (int y = 1; y < size - 1; y++) {
+                        const int row = z * slice + y * pitch;
+                        for (int i = 1 + ((1 + y + z + color) & 1); i < size - 1; i += 2) {
+                            const int idx = row + i;
+                            x[idx] = fluid[idx] * (x0[idx] + a * (
+                                x[idx - 1] + x[idx + 1] +
+                                x[idx - pitch] + x[idx + pitch] +
+                                x[idx - slice] + x[idx + slice]
+                            )) * invC;
+                        }
+                    }
+                }
+            });
+        }
+        setBoundary(b, x);
+    }
+}
+
+void FluidSim3D::diffuse(int b, float* x, float* x0, float diff) {
+    float a = dt * diff * (size - 2) * (size - 2);
+    linearSolve(b, x, x0, a, 1 + 6 * a);
+}
+
+void FluidSim3D::advect(int b, float* d, float* d0, float* u, float* v, float* w) {
+    const float dt0 = dt * size;
+    const float lo = 0.5f;
+    const float hi = size - 1.5f;
+    pool.parallelFor(1, size - 1, [&](int zBegin, int zEnd) {
+        for (int k = zBegin; k < zEnd; k++) {
+            for (int j = 1; j < size - 1; j++) {
+                const int row = k * slice + j * pitch;
+                for (int i = 1; i < size - 1; i++) {
+                    const int idx = row + i;
+
+                    float x = std::min(std::max(i - dt0 * u[idx], lo), hi);
+                    float y = std::min(std::max(j - dt0 * v[idx], lo), hi);
+                    float z = std::min(std::max(k - dt0 * w[idx], lo), hi);
+
+                    int i0 = static_cast<int>(x);
+                    int j0 = static_cast<int>(y);
+                    int k0 = static_cast<int>(z);
+
+                    float s1 = x - i0;
+                    float s0 = 1 - s1;
+                    float t1 = y - j0;
+                    float t0 = 1 - t1;
+                    float r1 = z - k0;
+                    float r0 = 1 - r1;
+
+                    const int c000 = i0 + j0 * pitch + k0 * slice;
+                    const int c010 = c000 + pitch;
+                    const int c001 = c000 + slice;
+                    const int c011 = c001 + pitch;
+
+                    // Any solid corner blanks the sample, as in the 2D solver.
+                    float open = fluid[c000] * fluid[c000 + 1] * fluid[c010] * fluid[c010 + 1] *
+                        fluid[c001] * fluid[c001 + 1] * fluid[c011] * fluid[c011 + 1];
+
+                    float value =
+                        s0 * (t0 * (r0 * d0[c000] + r1 * d0[c001]) + t1 * (r0 * d0[c010] + r1 * d0[c011])) +
+                        s1 * (t0 * (r0 * d0[c000 + 1] + r1 * d0[c001 + 1]) + t1 * (r0 * d0[c010 + 1] + r1 * d0[c011 + 1]));
+
+                    d[idx] = fluid[idx] * open * value;
+                }
+            }
+        }
+    });
+    setBoundary(b, d);
+}
+
+void FluidSim3D::project(float* u, float* v, float* w, float* p, float* div) {
+    const float invSize = 1.0f / size;
+    pool.parallelFor(1, size - 1, [&](int lo, int hi) {
+        for (int z = lo; z < hi; z++) {
+            for (int y = 1; y < size - 1; y++) {
+                const int row = z * slice + y * pitch;
+                for (int i = 1; i < size - 1; i++) {
+                    const int idx = row + i;
+                    div[idx] = -0.5f * fluid[idx] * (
+                        u[idx + 1] - u[idx - 1] +
+                        v[idx + pitch] - v[idx - pitch] +
+                        w[idx + slice] - w[idx - slice]
+                    ) * invSize;
+                    p[idx] = 0;
+                }
+            }
+        }
+    });
+    setBoundary(0, div);
+    setBoundary(0, p);
+
+    linearSolve(0, p, div, 1, 6);
+
+    const float halfSize = 0.5f * size;
+    pool.parallelFor(1, size - 1, [&](int lo, int hi) {
+        for (int z = lo; z < hi; z++) {
+            for (int y = 1; y < size - 1; y++) {
+                const int row = z * slice + y * pitch;
+                for (int i = 1; i < size - 1; i++) {
+                    const int idx = row + i;
+                    const float scale = halfSize * fluid[idx];
+                    u[idx] -= scale * (p[idx + 1] - p[idx - 1]);
+                    v[idx] -= scale * (p[idx + pitch] - p[idx - pitch]);
+                    w[idx] -= scale * (p[idx + slice] - p[idx - slice]);
+                }
+            }
+        }
+    });
+    setBoundary(1, u);
+    setBoundary(2, v);
+    setBoundary(3, w);
+}
+
+void FluidSim3D::step() {
+    // Diffuse velocity
+    diffuse(1, Vx0, Vx, viscosity);
+    std::swap(Vx, Vx0);
+
+    diffuse(2, Vy0, Vy, viscosity);
+    std::swap(Vy, Vy0);
+
+    diffuse(3, Vz0, Vz, viscosity);
+    std::swap(Vz, Vz0);
+
+    // Project velocity
+    project(Vx, Vy, Vz, Vx0, Vy0);
+
+    // Advect velocity
+    advect(1, Vx0, Vx, Vx, Vy, Vz);
+    advect(2, Vy0, Vy, Vx, Vy, Vz);
+    advect(3, Vz0, Vz, Vx, Vy, Vz);
+    std::swap(Vx, Vx0);
+    std::swap(Vy, Vy0);
+    std::swap(Vz, Vz0);
+
+    // Project again
+    project(Vx, Vy, Vz, Vx0, Vy0);
+
+    // Diffuse density
+    diffuse(0, s, density, diffusion);
+    std::swap(s, density);
+
+    // Advect density
+    advect(0, s, density, Vx, Vy, Vz);
+    std::swap(s, density);
+}
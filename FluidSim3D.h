@@ -0,0 +1,66 @@
+#pragma once
+#ifndef FLUIDSIM3D_H
+#define FLUIDSIM3D_H
+
+#include "WorkerPool.h"
+
+// 3D counterpart of FluidSim. Rows are padded to a multiple of the SIMD width
+// and allocated aligned, obstacles are kept as a 0/1 float mask so the sweeps
+// stay branch-free, and every kernel is split over z-slabs on a WorkerPool.
+class FluidSim3D
+{
+public:
+    FluidSim3D(int size, float diffusion, float viscosity, float dt, int threads = 0);
+    ~FluidSim3D();
+
+    FluidSim3D(const FluidSim3D&) = delete;
+    FluidSim3D& operator=(const FluidSim3D&) = delete;
+
+    void step();
+    void addDensity(int x, int y, int z, float amount);
+    void addVelocity(int x, int y, int z, float amountX, float amountY, float amountZ);
+    void getDensity(int x, int y, int z, float& density) const;
+    void getVelocity(int x, int y, int z, float& velX, float& velY, float& velZ) const;
+    int getSize() const;
+    float getDiffusion() const;
+    float getViscosity() const;
+    float getDT() const;
+
+    // Obstacle support
+    void setObstacle(int x, int y, int z, bool solid);
+    void clearObstacles();
+    bool isObstacle(int x, int y, int z) const;
+
+private:
+    int size;       // grid size (cells per axis, including the boundary layer)
+    int pitch;      // floats per row, padded to the SIMD width
+    int slice;      // floats per z-slice
+    float dt;       // timestep
+    float diffusion;
+    float viscosity;
+
+    float* s;       // temp density
+    float* density;
+
+    float* Vx;      // velocity x
+    float* Vy;      // velocity y
+    float* Vz;      // velocity z
+    float* Vx0;     // temp velocity x
+    float* Vy0;     // temp velocity y
+    float* Vz0;     // temp velocity z
+
+    float* fluid;   // 1 for fluid cells, 0 for obstacle voxels
+
+    WorkerPool pool;
+
+    int IX(int x, int y, int z) const;
+    float* allocField() const;
+
+    void diffuse(int b, float* x, float* x0, float diff);
+    void advect(int b, float* d, float* d0, float* velocX, float* velocY, float* velocZ);
+    void project(float* velocX, float* velocY, float* velocZ, float* p, float* div);
+    void linearSolve(int b, float* x, float* x0, float a, float c);
+    void setBoundary(int b, float* x);
+};
+
+#endif
@@ -0,0 +1,283 @@
+#include "FluidSim3DBaseline.h"
+#include <algorithm>
+#include <cmath>
+
+inline int FluidSim3DBaseline::IX(int x, int y, int z) const {
+    x = std::max(0, std::min(x, size - 1));
+    y = std::max(0, std::min(y, size - 1));
+    z = std::max(0, std::min(z, size - 1));
+    return x + y * size + z * size * size;
+}
+
+FluidSim3DBaseline::FluidSim3DBaseline(int size, float diffusion, float viscosity, float dt)
+    : size(size), diffusion(diffusion), viscosity(viscosity), dt(dt)
+{
+    int totalCells = size * size * size;
+    s = new float[totalCells]();
+    density = new float[totalCells]();
+    Vx = new float[totalCells]();
+    Vy = new float[totalCells]();
+    Vz = new float[totalCells]();
+    Vx0 = new float[totalCells]();
+    Vy0 = new float[totalCells]();
+    Vz0 = new float[totalCells]();
+    obstacles = new bool[totalCells]();
+}
+
+FluidSim3DBaseline::~FluidSim3DBaseline() {
+    delete[] s;
+    delete[] density;
+    delete[] Vx;
+    delete[] Vy;
+    delete[] Vz;
+    delete[] Vx0;
+    delete[] Vy0;
+    delete[] Vz0;
+    delete[] obstacles;
+}
+
+void FluidSim3DBaseline::setObstacle(int x, int y, int z, bool solid) {
+    obstacles[IX(x, y, z)] = solid;
+}
+
+bool FluidSim3DBaseline::isObstacle(int x, int y, int z) const {
+    return obstacles[IX(x, y, z)];
+}
+
+void FluidSim3DBaseline::addDensity(int x, int y, int z, float amount) {
+    if (!isObstacle(x, y, z)) {
+        density[IX(x, y, z)] += amount;
+    }
+}
+
+void FluidSim3DBaseline::addVelocity(int x, int y, int z, float amountX, float amountY, float amountZ) {
+    if (!isObstacle(x, y, z)) {
+        int idx = IX(x, y, z);
+        Vx[idx] += amountX;
+        Vy[idx] += amountY;
+        Vz[idx] += amountZ;
+    }
+}
+
+void FluidSim3DBaseline::getDensity(int x, int y, int z, float& outDensity) const {
+    outDensity = density[IX(x, y, z)];
+}
+
+void FluidSim3DBaseline::getVelocity(int x, int y, int z, float& velX, float& velY, float& velZ) const {
+    int idx = IX(x, y, z);
+    velX = Vx[idx];
+    velY = Vy[idx];
+    velZ = Vz[idx];
+}
+
+int FluidSim3DBaseline::getSize() const { return size; }
+float FluidSim3DBaseline::getDT() const { return dt; }
+
+// b is the velocity component the boundary negates: 1 = x, 2 = y, 3 = z,
+// 0 for scalars.
+void FluidSim3DBaseline::setBoundary(int b, float* x) {
+    const int n = size - 1;
+    for (int j = 1; j < n; j++) {
+        for (int i = 1; i < n; i++) {
+            x[IX(i, j, 0)] = b == 3 ? -x[IX(i, j, 1)] : x[IX(i, j, 1)];
+            x[IX(i, j, n)] = b == 3 ? -x[IX(i, j, n - 1)] : x[IX(i, j, n - 1)];
+            x[IX(i, 0, j)] = b == 2 ? -x[IX(i, 1, j)] : x[IX(i, 1, j)];
+            x[IX(i, n, j)] = b == 2 ? -x[IX(i, n - 1, j)] : x[IX(i, n - 1, j)];
+            x[IX(0, i, j)] = b == 1 ? -x[IX(1, i, j)] : x[IX(1, i, j)];
+            x[IX(n, i, j)] = b == 1 ? -x[IX(n - 1, i, j)] : x[IX(n - 1, i, j)];
+        }
+    }
+
+    for (int i = 1; i < n; i++) {
+        x[IX(i, 0, 0)] = 0.5f * (x[IX(i, 1, 0)] + x[IX(i, 0, 1)]);
+        x[IX(i, n, 0)] = 0.5f * (x[IX(i, n - 1, 0)] + x[IX(i, n, 1)]);
+        x[IX(i, 0, n)] = 0.5f * (x[IX(i, 1, n)] + x[IX(i, 0, n - 1)]);
+        x[IX(i, n, n)] = 0.5f * (x[IX(i, n - 1, n)] + x[IX(i, n, n - 1)]);
+
+        x[IX(0, i, 0)] = 0.5f * (x[IX(1, i, 0)] + x[IX(0, i, 1)]);
+        x[IX(n, i, 0)] = 0.5f * (x[IX(n - 1, i, 0)] + x[IX(n, i, 1)]);
+        x[IX(0, i, n)] = 0.5f * (x[IX(1, i, n)] + x[IX(0, i, n - 1)]);
+        x[IX(n, i, n)] = 0.5f * (x[IX(n - 1, i, n)] + x[IX(n, i, n - 1)]);
+
+        x[IX(0, 0, i)] = 0.5f * (x[IX(1, 0, i)] + x[IX(0, 1, i)]);
+        x[IX(n, 0, i)] = 0.5f * (x[IX(n - 1, 0, i)] + x[IX(n, 1, i)]);
+        x[IX(0, n, i)] = 0.5f * (x[IX(1, n, i)] + x[IX(0, n - 1, i)]);
+        x[IX(n, n, i)] = 0.5f * (x[IX(n - 1, n, i)] + x[IX(n, n - 1, i)]);
+    }
+
+    const float third = 1.0f / 3.0f;
+    x[IX(0, 0, 0)] = third * (x[IX(1, 0, 0)] + x[IX(0, 1, 0)] + x[IX(0, 0, 1)]);
+    x[IX(n, 0, 0)] = third * (x[IX(n - 1, 0, 0)] + x[IX(n, 1, 0)] + x[IX(n, 0, 1)]);
+    x[IX(0, n, 0)] = third * (x[IX(1, n, 0)] + x[IX(0, n - 1, 0)] + x[IX(0, n, 1)]);
+    x[IX(n, n, 0)] = third * (x[IX(n - 1, n, 0)] + x[IX(n, n - 1, 0)] + x[IX(n, n, 1)]);
+    x[IX(0, 0, n)] = third * (x[IX(1, 0, n)] + x[IX(0, 1, n)] + x[IX(0, 0, n - 1)]);
+    x[IX(n, 0, n)] = third * (x[IX(n - 1, 0, n)] + x[IX(n, 1, n)] + x[IX(n, 0, n - 1)]);
+    x[IX(0, n, n)] = third * (x[IX(1, n, n)] + x[IX(0, n - 1, n)] + x[IX(0, n, n - 1)]);
+    x[IX(n, n, n)] = third * (x[IX(n - 1, n, n)] + x[IX(n, n - 1, n)] + x[IX(n, n, n - 1)]);
+
+    for (int k = 0; k < size; k++) {
+        for (int j = 0; j < size; j++) {
+            for (int i = 0; i < size; i++) {
+                if (obstacles[IX(i, j, k)]) x[IX(i, j, k)] = 0.0f;
+            }
+        }
+    }
+}
+
+void FluidSim3DBaseline::diffuse(int b, float* x, float* x0, float diff) {
+    float a = dt * diff * (size - 2) * (size - 2);
+    for (int iter = 0; iter < 20; iter++) {
+        for (int k = 1; k < size - 1; k++) {
+            for (int j = 1; j < size - 1; j++) {
+                for (int i = 1; i < size - 1; i++) {
+                    if (!obstacles[IX(i, j, k)]) {
+                        x[IX(i, j, k)] = (x0[IX(i, j, k)] + a * (
+                            x[IX(i - 1, j, k)] + x[IX(i + 1, j, k)] +
+                            x[IX(i, j - 1, k)] + x[IX(i, j + 1, k)] +
+                            x[IX(i, j, k - 1)] + x[IX(i, j, k + 1)]
+                        )) / (1 + 6 * a);
+                    }
+                }
+            }
+        }
+        setBoundary(b, x);
+    }
+}
+
+void FluidSim3DBaseline::advect(int b, float* d, float* d0, float* u, float* v, float* w) {
+    float dt0 = dt * size;
+    for (int k = 1; k < size - 1; k++) {
+        for (int j = 1; j < size - 1; j++) {
+            for (int i = 1; i < size - 1; i++) {
+                if (obstacles[IX(i, j, k)]) {
+                    d[IX(i, j, k)] = 0.0f;
+                    continue;
+                }
+
+                float x = i - dt0 * u[IX(i, j, k)];
+                float y = j - dt0 * v[IX(i, j, k)];
+                float z = k - dt0 * w[IX(i, j, k)];
+
+                x = std::min(std::max(x, 0.5f), size - 1.5f);
+                y = std::min(std::max(y, 0.5f), size - 1.5f);
+                z = std::min(std::max(z, 0.5f), size - 1.5f);
+
+                int i0 = static_cast<int>(x);
+                int i1 = i0 + 1;
+                int j0 = static_cast<int>(y);
+                int j1 = j0 + 1;
+                int k0 = static_cast<int>(z);
+                int k1 = k0 + 1;
+
+                float s1 = x - i0;
+                float s0 = 1 - s1;
+                float t1 = y - j0;
+                float t0 = 1 - t1;
+                float r1 = z - k0;
+                float r0 = 1 - r1;
+
+                if (obstacles[IX(i0, j0, k0)] || obstacles[IX(i0, j1, k0)] ||
+                    obstacles[IX(i1, j0, k0)] || obstacles[IX(i1, j1, k0)] ||
+                    obstacles[IX(i0, j0, k1)] || obstacles[IX(i0, j1, k1)] ||
+                    obstacles[IX(i1, j0, k1)] || obstacles[IX(i1, j1, k1)]) {
+                    d[IX(i, j, k)] = 0.0f;
+                }
+                else {
+                    d[IX(i, j, k)] =
+                        s0 * (t0 * (r0 * d0[IX(i0, j0, k0)] + r1 * d0[IX(i0, j0, k1)]) +
+                              t1 * (r0 * d0[IX(i0, j1, k0)] + r1 * d0[IX(i0, j1, k1)])) +
+                        s1 * (t0 * (r0 * d0[IX(i1, j0, k0)] + r1 * d0[IX(i1, j0, k1)]) +
+                              t1 * (r0 * d0[IX(i1, j1, k0)] + r1 * d0[IX(i1, j1, k1)]));
+                }
+            }
+        }
+    }
+    setBoundary(b, d);
+}
+
+void FluidSim3DBaseline::project(float* u, float* v, float* w, float* p, float* div) {
+    for (int k = 1; k < size - 1; k++) {
+        for (int j = 1; j < size - 1; j++) {
+            for (int i = 1; i < size - 1; i++) {
+                if (obstacles[IX(i, j, k)]) {
+                    div[IX(i, j, k)] = 0;
+                    p[IX(i, j, k)] = 0;
+                    continue;
+                }
+                div[IX(i, j, k)] = -0.5f * (
+                    u[IX(i + 1, j, k)] - u[IX(i - 1, j, k)] +
+                    v[IX(i, j + 1, k)] - v[IX(i, j - 1, k)] +
+                    w[IX(i, j, k + 1)] - w[IX(i, j, k - 1)]
+                ) / size;
+                p[IX(i, j, k)] = 0;
+            }
+        }
+    }
+    setBoundary(0, div);
+    setBoundary(0, p);
+
+    for (int iter = 0; iter < 20; iter++) {
+        for (int k = 1; k < size - 1; k++) {
+            for (int j = 1; j < size - 1; j++) {
+                for (int i = 1; i < size - 1; i++) {
+                    if (!obstacles[IX(i, j, k)]) {
+                        p[IX(i, j, k)] = (div[IX(i, j, k)] +
+                            p[IX(i - 1, j, k)] + p[IX(i + 1, j, k)] +
+                            p[IX(i, j - 1, k)] + p[IX(i, j + 1, k)] +
+                            p[IX(i, j, k - 1)] + p[IX(i, j, k + 1)]) / 6;
+                    }
+                }
+            }
+        }
+        setBoundary(0, p);
+    }
+
+    for (int k = 1; k < size - 1; k++) {
+        for (int j = 1; j < size - 1; j++) {
+            for (int i = 1; i < size - 1; i++) {
+                if (!obstacles[IX(i, j, k)]) {
+                    u[IX(i, j, k)] -= 0.5f * size * (p[IX(i + 1, j, k)] - p[IX(i - 1, j, k)]);
+                    v[IX(i, j, k)] -= 0.5f * size * (p[IX(i, j + 1, k)] - p[IX(i, j - 1, k)]);
+                    w[IX(i, j, k)] -= 0.5f * size * (p[IX(i, j, k + 1)] - p[IX(i, j, k - 1)]);
+                }
+            }
+        }
+    }
+    setBoundary(1, u);
+    setBoundary(2, v);
+    setBoundary(3, w);
+}
+
+void FluidSim3DBaseline::step() {
+    // Diffuse velocity
+    diffuse(1, Vx0, Vx, viscosity);
+    std::swap(Vx, Vx0);
+
+    diffuse(2, Vy0, Vy, viscosity);
+    std::swap(Vy, Vy0);
+
+    diffuse(3, Vz0, Vz, viscosity);
+    std::swap(Vz, Vz0);
+
+    // Project velocity
+    project(Vx, Vy, Vz, Vx0, Vy0);
+
+    // Advect velocity
+    advect(1, Vx0, Vx, Vx, Vy, Vz);
+    advect(2, Vy0, Vy, Vx, Vy, Vz);
+    advect(3, Vz0, Vz, Vx, Vy, Vz);
+    std::swap(Vx, Vx0);
+    std::swap(Vy, Vy0);
+    std::swap(Vz, Vz0);
+
+    // Project again
+    project(Vx, Vy, Vz, Vx0, Vy0);
+
+    // Diffuse density
+    diffuse(0, s, density, diffusion);
+    std::swap(s, density);
+
+    // Advect density
+    advect(0, s, density, Vx, Vy, Vz);
+    std::swap(s, density);
+}
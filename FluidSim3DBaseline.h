@@ -0,0 +1,57 @@
+#pragma once
+#ifndef FLUIDSIM3DBASELINE_H
+#define FLUIDSIM3DBASELINE_H
+
+// FluidSimBaseline carried over to 3D line for line: unpadded fields, a bool
+// obstacle grid tested per cell, lexicographic Gauss-Seidel and one thread.
+// It is the scalar reference the benchmark measures FluidSim3D against, so
+// it computes the same scheme without any of FluidSim3D's layout or
+// threading. Do not optimise.
+class FluidSim3DBaseline
+{
+public:
+    FluidSim3DBaseline(int size, float diffusion, float viscosity, float dt);
+    ~FluidSim3DBaseline();
+
+    FluidSim3DBaseline(const FluidSim3DBaseline&) = delete;
+    FluidSim3DBaseline& operator=(const FluidSim3DBaseline&) = delete;
+
+    void step();
+    void addDensity(int x, int y, int z, float amount);
+    void addVelocity(int x, int y, int z, float amountX, float amountY, float amountZ);
+    void getDensity(int x, int y, int z, float& density) const;
+    void getVelocity(int x, int y, int z, float& velX, float& velY, float& velZ) const;
+    int getSize() const;
+    float getDT() const;
+
+    // Obstacle support
+    void setObstacle(int x, int y, int z, bool solid);
+    bool isObstacle(int x, int y, int z) const;
+
+private:
+    int size;       // grid size
+    float diffusion;
+    float viscosity;
+    float dt;       // timestep
+
+    float* s;       // temp density
+    float* density;
+
+    float* Vx;      // velocity x
+    float* Vy;      // velocity y
+    float* Vz;      // velocity z
+    float* Vx0;     // temp velocity x
+    float* Vy0;     // temp velocity y
+    float* Vz0;     // temp velocity z
+
+    bool* obstacles; // obstacle grid
+
+    int IX(int x, int y, int z) const;
+
+    void diffuse(int b, float* x, float* x0, float diff);
+    void advect(int b, float* d, float* d0, float* velocX, float* velocY, float* velocZ);
+    void project(float* velocX, float* velocY, float* velocZ, float* p, float* div);
+    void setBoundary(int b, float* x);
+};
+
+#endif
@@ -0,0 +1,323 @@
+// Headless driver: runs the wind-tunnel setup from main.cpp without a window
+// and prints timing, total density, the force on the obstacle, the dominant
+// frequency of the cross-stream velocity in its wake and the solver's
+// per-phase statistics, with hardware counters where the kernel allows
+// perf_event_open.
+//
+// Usage: fluidsim_run [size] [steps] [density.pgm] [trace.json]
+//        fluidsim_run --cut-drag [size] [max steps] [offsets]
+//        fluidsim_run --quadtree [size] [steps] [max leaf size]
+//
+// The optional PGM is the final density, scaled like the viewer's intensity;
+// the optional trace is a Chrome trace of every step. --cut-drag moves a
+// cylinder through sub-cell offsets and compares how much its converged drag
+// changes with cut cells and with binary obstacles. --quadtree runs the same
+// square obstacle on the adaptive quadtree and on a uniform grid of twice its
+// finest resolution and compares the wake drag, the dominant frequency in the
+// wake and the time per step.
+
+#include "FluidSim.h"
+#include "QuadtreeFluidSim.h"
+#include "SlidingSpectrum.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// Drag on a cylinder of diameter size / 8 in a walled tunnel, its centre
+// shifted by offset cells along both axes. The viscosity puts the Reynolds
+// number at 20, where the flow is steady, so the drag settles: it is
+// averaged over blocks of 100 steps until two blocks agree within 0.1%.
+// steps is then the number taken, or -1 if maxSteps ran out first.
+static double cylinderDrag(int size, bool cut, float offset, int maxSteps, int& steps) {
+    FluidSim fluid(size, 0.00001f, 0.000625f, 0.05f);
+    fluid.setCutCells(cut);
+    fluid.setObstacleRect(0, 0, size, 1);
+    fluid.setObstacleRect(0, size - 1, size, size);
+    fluid.setInflow(FluidSim::EdgeLeft, 0.1f, 0.0f, 0.0f, 1, size - 1);
+    fluid.setBoundaryType(FluidSim::EdgeRight, FluidSim::BoundaryType::Outflow);
+    fluid.setObstacleCircle(0.3f * size + offset, 0.5f * size + offset, size / 16.0f, 1);
+
+    const int block = 100;
+    double previous = 0.0, drag = 0.0;
+    for (int step = 1; step <= maxSteps; step++) {
+        fluid.step();
+        drag += fluid.getBodyForce(1).x;
+        if (step % block != 0) continue;
+        drag /= block;
+        if (step > block && std::fabs(drag - previous) < 1e-3 * std::fabs(drag)) {
+            steps = step;
+            return drag;
+        }
+        previous = drag;
+        drag = 0.0;
+    }
+    steps = -1;
+    return previous;
+}
+
+// A body that moves by a fraction of a cell should keep its drag; the spread
+// over the offsets is the error the staircase (or the cut faces) adds.
+static int compareCutDrag(int size, int maxSteps, int offsets) {
+    std::printf("cylinder drag at size %d, Re 20, offsets in cells\n", size);
+    std::printf("offset     cut cells  steps       binary  steps\n");
+    double low[2] = { 1e30, 1e30 }, high[2] = { -1e30, -1e30 };
+    for (int k = 0; k < offsets; k++) {
+        float offset = static_cast<float>(k) / offsets;
+        int steps[2];
+        double drag[2];
+        for (int cut = 0; cut < 2; cut++) {
+            drag[cut] = cylinderDrag(size, cut == 1, offset, maxSteps, steps[cut]);
+            low[cut] = std::min(low[cut], drag[cut]);
+            high[cut] = std::max(high[cut], drag[cut]);
+        }
+        std::printf("%6.3f %12.6g %6d %12.6g %6d\n", offset, drag[1], steps[1], drag[0], steps[0]);
+    }
+    std::printf("spread over offsets: cut %.1f%%, binary %.1f%%\n",
+                200.0 * (high[1] - low[1]) / (high[1] + low[1]), 200.0 * (high[0] - low[0]) / (high[0] + low[0]));
+    return 0;
+}
+
+struct WakeRun
+{
+    double msPerStep;
+    double drag;
+    double frequency;
+    double amplitude;
+    bool converged;
+    bool lowestBin;     // the peak sits in the lowest bin: drift, not shedding
+};
+
+// Square obstacle of size / 8 in a closed box, driven by velocity added
+// every step over columns size / 16 to size / 8, which covers whole leaves
+// of up to size / 16 cells. Only the API the quadtree shares with FluidSim
+// is used, so both solvers see the same forcing. Two and a half obstacle
+// sizes downstream the drag is taken from the momentum deficit across the
+// tunnel, the integral of u (U - u) with U the speed one obstacle size
+// upstream, averaged over the second half of the run; the cross-stream
+// velocity just off the centre line there feeds the spectrum. Its window is
+// the second half of the run and its band starts at 0.02, well below the
+// shedding frequency but above the slow drift of the spin-up.
+template <class Solver>
+static WakeRun squareWake(Solver& fluid, int steps) {
+    const int size = fluid.getSize();
+    const int obsSize = size / 8;
+    const int obsStartX = size / 2;
+    const int obsStartY = size / 2 - obsSize / 2;
+    for (int i = 0; i < size; i++) {
+        fluid.setObstacle(i, 0, true);
+        fluid.setObstacle(i, size - 1, true);
+    }
+    for (int j = obsStartY; j < obsStartY + obsSize; j++) {
+        for (int i = obsStartX; i < obsStartX + obsSize; i++) fluid.setObstacle(i, j, true);
+    }
+    const int wakeX = obsStartX + obsSize * 5 / 2;
+    const int probeY = size / 2 + obsSize / 4;
+    SlidingSpectrum wake(std::max(64, steps / 2), fluid.getDT(), 0.02, 1.0);
+
+    double drag = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (int step = 0; step < steps; step++) {
+        for (int j = size / 3; j < 2 * size / 3; j++) {
+            for (int i = size / 16; i < size / 8; i++) fluid.addVelocity(i, j, 0.02f, 0.0f);
+        }
+        fluid.step();
+        float u, v;
+        fluid.getVelocity(wakeX, probeY, u, v);
+        wake.push(v);
+        if (2 * step >= steps) {
+            float speed, unused;
+            fluid.getVelocity(obsStartX - obsSize, size / 2, speed, unused);
+            double deficit = 0.0;
+            for (int j = 1; j < size - 1; j++) {
+                fluid.getVelocity(wakeX, j, u, v);
+                deficit += u * (speed - u);
+            }
+            drag += deficit / size;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WakeRun run = { 1000.0 * seconds / steps, drag / (steps - (steps + 1) / 2), wake.getFrequency(),
+                    wake.getAmplitude(), wake.isConverged(),
+                    wake.getBinCount() > 0 && wake.getFrequency() <= wake.getBinFrequency(0) };
+    return run;
+}
+
+static void printWake(const char* solver, const WakeRun& run, int cells) {
+    std::printf("%-11s %8.3f %7d %12.6g %10.5f %10.4g%s%s\n", solver, run.msPerStep, cells, run.drag,
+                run.frequency, run.amplitude, run.converged ? "" : " (not converged)",
+                run.lowestBin ? " (lowest bin)" : "");
+}
+
+// The reference is a uniform grid at twice the finest resolution of the
+// tree, so the quadtree is measured against a better resolved wake rather
+// than against the grid it coarsens.
+static int compareQuadtree(int size, int steps, int maxLeaf) {
+    FluidSim uniform(2 * size, 0.00001f, 0.0000001f, 0.2f);
+    QuadtreeFluidSim tree(size, maxLeaf, 0.00001f, 0.0000001f, 0.2f);
+    WakeRun reference = squareWake(uniform, steps);
+    WakeRun adaptive = squareWake(tree, steps);
+    std::printf("square obstacle wake over %d steps, quadtree size %d, uniform reference %d\n",
+                steps, size, 2 * size);
+    std::printf("solver       ms/step   cells         drag  frequency  amplitude\n");
+    printWake("uniform 2x", reference, 4 * size * size);
+    printWake("quadtree", adaptive, tree.getLeafCount());
+    if (reference.drag != 0.0) {
+        std::printf("quadtree drag error %.1f%%\n", 100.0 * (adaptive.drag - reference.drag) / reference.drag);
+    }
+    // A peak that wanders or sits on the lowest bin is no shedding frequency.
+    if (reference.converged && adaptive.converged && !reference.lowestBin && !adaptive.lowestBin) {
+        std::printf("quadtree frequency error %.1f%%\n",
+                    100.0 * (adaptive.frequency - reference.frequency) / reference.frequency);
+    }
+    else {
+        std::printf("no shedding frequency to compare\n");
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::strcmp(argv[1], "--quadtree") == 0) {
+        const int size = argc > 2 ? std::atoi(argv[2]) : 64;
+        const int steps = argc > 3 ? std::atoi(argv[3]) : 4000;
+        const int maxLeaf = argc > 4 ? std::atoi(argv[4]) : 8;
+        if (size < 32 || steps < 2 || maxLeaf < 1) {
+            std::cerr << "Usage: " << argv[0] << " --quadtree [size] [steps] [max leaf size]" << std::endl;
+            return 1;
+        }
+        return compareQuadtree(size, steps, maxLeaf);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--cut-drag") == 0) {
+        const int size = argc > 2 ? std::atoi(argv[2]) : 64;
+        const int maxSteps = argc > 3 ? std::atoi(argv[3]) : 3000;
+        const int offsets = argc > 4 ? std::atoi(argv[4]) : 4;
+        if (size < 32 || maxSteps < 200 || offsets < 1) {
+            std::cerr << "Usage: " << argv[0] << " --cut-drag [size] [max steps] [offsets]" << std::endl;
+            return 1;
+        }
+        return compareCutDrag(size, maxSteps, offsets);
+    }
+
+    const int simSize = argc > 1 ? std::atoi(argv[1]) : 128;
+    const int steps = argc > 2 ? std::atoi(argv[2]) : 500;
+    if (simSize < 8 || steps < 0) {
+        std::cerr << "Usage: " << argv[0] << " [size] [steps] [density.pgm] [trace.json]" << std::endl;
+        return 1;
+    }
+
+    FluidSim fluid(simSize, 0.00001f, 0.0000001f, 0.2f);
+    fluid.setStatsEnabled(true);
+    fluid.setHardwareCounters(true);
+
+    // Set up wind tunnel boundaries
+    fluid.setObstacleRect(0, 0, simSize, 1);
+    fluid.setObstacleRect(0, simSize - 1, simSize, simSize);
+
+    // Set up obstacle - centered in wind tunnel
+    int obsSize = simSize / 8;
+    int obsStartX = simSize / 2;
+    int obsEndX = obsStartX + obsSize;
+    int obsStartY = simSize / 2 - obsSize / 2;
+    int obsEndY = obsStartY + obsSize;
+    fluid.setObstacleRect(obsStartX, obsStartY, obsEndX, obsEndY, 1);
+
+    // Add strong initial fluid
+    int injectionStart = simSize / 3;
+    int injectionEnd = 2 * simSize / 3;
+    fluid.addSource(2, injectionStart, 3, injectionEnd, 3000.0f, 100.0f, 0.0f);
+
+    // Constant inflow through the middle third of the left edge; the wake
+    // leaves through the right edge instead of reflecting upstream
+    const float inflow = 0.1f;
+    fluid.setInflow(FluidSim::EdgeLeft, inflow, 0.0f, 1000.0f, injectionStart, injectionEnd);
+    fluid.setBoundaryType(FluidSim::EdgeRight, FluidSim::BoundaryType::Outflow);
+
+    // Wake probe two and a half obstacle sizes downstream, off the centre line
+    int wakeProbe = fluid.addProbe(obsStartX + 2.5f * obsSize, simSize / 2 + 0.25f * obsSize);
+    int wakeSpectrum = fluid.addProbeSpectrum(wakeProbe, FluidSim::ProbeSignal::VelocityY,
+        std::max(64, steps / 2), 0.005f, 1.0f);
+
+    if (argc > 4) Trace::setEnabled(true);
+    auto start = std::chrono::steady_clock::now();
+    for (int step = 0; step < steps; step++) {
+        fluid.step();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const TiledField& densityField = fluid.getDensityField();
+    double total = 0.0;
+    for (int j = 0; j < simSize; j++) {
+        for (int i = 0; i < simSize; i++) {
+            total += densityField.get(i, j);
+        }
+    }
+    FluidSim::BodyForce force = fluid.getBodyForce(1);
+
+    std::cout << "size " << simSize << ", steps " << steps << "\n"
+              << "time " << seconds << " s (" << (steps ? 1000.0 * seconds / steps : 0.0) << " ms/step)\n"
+              << "total density " << total << "\n"
+              << "drag " << force.x << ", lift " << force.y
+              << " (viscous " << force.viscousX << ", " << force.viscousY << ")" << std::endl;
+
+    const SlidingSpectrum& wake = fluid.getProbeSpectrum(wakeSpectrum);
+    if (wake.isFull()) {
+        std::cout << "wake frequency " << wake.getFrequency() << ", amplitude " << wake.getAmplitude()
+                  << ", strouhal " << wake.getFrequency() * obsSize / (simSize * inflow)
+                  << (wake.isConverged() ? " (converged)" : " (not converged)") << std::endl;
+    }
+
+    FluidSim::Stats stats = fluid.getStats();
+    if (stats.enabled) {
+        std::cout << "phase            mean ms   max ms  iters  residual      cells\n";
+        for (const FluidSim::PhaseStats& phase : stats.phases) {
+            std::printf("%-15s %8.3f %8.3f %6d %9.3g %10lld\n", phase.name, phase.meanMs,
+                        phase.maxMs, phase.iterations, phase.residual, phase.cells);
+        }
+        if (stats.countersAvailable) {
+            std::printf("%-15s", "phase (last)");
+            for (int c = 0; c < PerfCounters::CounterCount; c++) {
+                if (stats.counting[c]) std::printf(" %14s", PerfCounters::getName(c));
+            }
+            std::printf("      IPC\n");
+            for (const FluidSim::PhaseStats& phase : stats.phases) {
+                std::printf("%-15s", phase.name);
+                for (int c = 0; c < PerfCounters::CounterCount; c++) {
+                    if (stats.counting[c]) std::printf(" %14llu", phase.counters[c]);
+                }
+                unsigned long long cycles = phase.counters[PerfCounters::Cycles];
+                std::printf(" %8.2f\n", cycles ? double(phase.counters[PerfCounters::Instructions]) / cycles : 0.0);
+            }
+        } else {
+            std::cout << "hardware counters unavailable (perf_event_open)" << std::endl;
+        }
+    }
+
+    if (argc > 4 && !Trace::writeChromeJson(argv[4])) {
+        std::cerr << "Cannot write " << argv[4] << std::endl;
+        return 1;
+    }
+
+    if (argc > 3) {
+        std::ofstream out(argv[3], std::ios::binary);
+        if (!out) {
+            std::cerr << "Cannot write " << argv[3] << std::endl;
+            return 1;
+        }
+        out << "P5\n" << simSize << " " << simSize << "\n255\n";
+        std::vector<unsigned char> row(simSize);
+        for (int j = simSize - 1; j >= 0; j--) {
+            for (int i = 0; i < simSize; i++) {
+                float d = densityField.get(i, j);
+                row[i] = static_cast<unsigned char>(255.0f * std::max(0.0f, std::min(d / 1000.0f, 1.0f)));
+            }
+            out.write(reinterpret_cast<const char*>(row.data()), simSize);
+        }
+    }
+    return 0;
+}
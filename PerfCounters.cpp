@@ -0,0 +1,99 @@
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int openCounter(unsigned type, unsigned long long config, int group) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group == -1 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+
+static unsigned long long cacheMiss(unsigned cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+#endif
+
+PerfCounters::PerfCounters() : members(0) {
+    for (int c = 0; c < CounterCount; c++) {
+        fds[c] = -1;
+        slot[c] = -1;
+    }
+#ifdef __linux__
+    // Cycles leads the group so all counters cover the same intervals.
+    fds[Cycles] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (fds[Cycles] < 0) return;
+    int leader = fds[Cycles];
+    slot[Cycles] = members++;
+
+    fds[Instructions] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leader);
+    fds[LlcMisses] = openCounter(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_LL), leader);
+    fds[DtlbMisses] = openCounter(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_DTLB), leader);
+    fds[StalledCycles] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND, leader);
+    if (fds[StalledCycles] < 0) {
+        fds[StalledCycles] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND, leader);
+    }
+    for (int c = Instructions; c < CounterCount; c++) {
+        if (fds[c] >= 0) slot[c] = members++;
+    }
+
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (int c = CounterCount - 1; c >= 0; c--) {
+        if (fds[c] >= 0) close(fds[c]);
+    }
+#endif
+}
+
+bool PerfCounters::isAvailable() const {
+    return members > 0;
+}
+
+bool PerfCounters::isCounting(int counter) const {
+    return counter >= 0 && counter < CounterCount && slot[counter] >= 0;
+}
+
+void PerfCounters::read(unsigned long long values[CounterCount]) const {
+    for (int c = 0; c < CounterCount; c++) values[c] = 0;
+#ifdef __linux__
+    if (members == 0) return;
+
+    // Group layout: nr, time enabled, time running, one value per member.
+    unsigned long long buffer[3 + CounterCount];
+    ssize_t bytes = ::read(fds[Cycles], buffer, sizeof(buffer));
+    if (bytes < static_cast<ssize_t>(3 * sizeof(unsigned long long))) return;
+
+    double scale = 1.0;
+    if (buffer[2] > 0 && buffer[2] < buffer[1]) {
+        scale = static_cast<double>(buffer[1]) / buffer[2];
+    }
+    for (int c = 0; c < CounterCount; c++) {
+        if (slot[c] >= 0 && static_cast<unsigned long long>(slot[c]) < buffer[0]) {
+            values[c] = static_cast<unsigned long long>(buffer[3 + slot[c]] * scale);
+        }
+    }
+#endif
+}
+
+const char* PerfCounters::getName(int counter) {
+    static const char* names[CounterCount] = {
+        "cycles", "instructions", "llcMisses", "dtlbMisses", "stalledCycles"
+    };
+    return counter >= 0 && counter < CounterCount ? names[counter] : "unknown";
+}
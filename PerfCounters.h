@@ -0,0 +1,43 @@
+#pragma once
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+// Hardware performance counters of the calling thread, read through
+// perf_event_open on Linux (user-space counts only). Counters the CPU or
+// kernel does not provide are reported as unavailable; on other platforms,
+// or when perf_event_paranoid or a container forbids access, none are.
+class PerfCounters
+{
+public:
+    enum Counter
+    {
+        Cycles,
+        Instructions,
+        LlcMisses,
+        DtlbMisses,
+        StalledCycles,      // backend stalls, or frontend where that is all there is
+        CounterCount
+    };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool isAvailable() const;
+    bool isCounting(int counter) const;
+
+    // Running totals since construction, scaled up if the kernel had to
+    // multiplex the group. Unavailable counters read as 0.
+    void read(unsigned long long values[CounterCount]) const;
+
+    static const char* getName(int counter);
+
+private:
+    int fds[CounterCount];
+    int slot[CounterCount];     // position in the group read, -1 if not counting
+    int members;
+};
+
+#endif
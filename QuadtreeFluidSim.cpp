@@ -0,0 +1,598 @@
+#include "QuadtreeFluidSim.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+QuadtreeFluidSim::QuadtreeFluidSim(int size, int maxLeafSize, float diffusion, float viscosity, float dt)
+    : size(size), maxLeafSize(1), levels(1), dt(dt), diffusion(diffusion), viscosity(viscosity),
+      vorticityTolerance(0.01f), remeshInterval(4), stepCount(0), obstaclesDirty(true)
+{
+    // Largest power of two that is <= maxLeafSize and tiles the domain.
+    while (maxLeafSize >= this->maxLeafSize * 2 && size % (this->maxLeafSize * 2) == 0) {
+        this->maxLeafSize *= 2;
+        levels++;
+    }
+
+    obstacles = new bool[size * size]();
+    leafAt.assign(size * size, 0);
+
+    // Start from the coarsest uniform tree; the first step refines it.
+    const int roots = size / this->maxLeafSize;
+    for (int by = 0; by < roots; by++) {
+        for (int bx = 0; bx < roots; bx++) {
+            Leaf leaf = { bx * this->maxLeafSize, by * this->maxLeafSize, this->maxLeafSize };
+            int id = static_cast<int>(leaves.size());
+            leaves.push_back(leaf);
+            for (int j = leaf.y; j < leaf.y + leaf.h; j++) {
+                std::fill(leafAt.begin() + j * size + leaf.x, leafAt.begin() + j * size + leaf.x + leaf.h, id);
+            }
+        }
+    }
+
+    const size_t count = leaves.size();
+    leafSolid.assign(count, 0);
+    density.assign(count, 0.0f);
+    s.assign(count, 0.0f);
+    Vx.assign(count, 0.0f);
+    Vy.assign(count, 0.0f);
+    Vx0.assign(count, 0.0f);
+    Vy0.assign(count, 0.0f);
+    buildNeighbours();
+}
+
+QuadtreeFluidSim::~QuadtreeFluidSim() {
+    delete[] obstacles;
+}
+
+int QuadtreeFluidSim::clampCoord(int v) const {
+    return std::max(0, std::min(v, size - 1));
+}
+
+int QuadtreeFluidSim::levelOf(int h) const {
+    int level = 0;
+    while ((1 << level) < h) level++;
+    return level;
+}
+
+void QuadtreeFluidSim::setObstacle(int x, int y, bool solid) {
+    obstacles[clampCoord(x) + clampCoord(y) * size] = solid;
+    obstaclesDirty = true;
+}
+
+void QuadtreeFluidSim::clearObstacles() {
+    memset(obstacles, 0, size * size * sizeof(bool));
+    obstaclesDirty = true;
+}
+
+bool QuadtreeFluidSim::isObstacle(int x, int y) const {
+    return obstacles[clampCoord(x) + clampCoord(y) * size];
+}
+
+// Sources are given per finest cell, so they are scaled by the leaf area.
+void QuadtreeFluidSim::addDensity(int x, int y, float amount) {
+    if (isObstacle(x, y)) return;
+    int c = leafAt[clampCoord(x) + clampCoord(y) * size];
+    if (leafSolid[c]) return;
+    density[c] += amount / (leaves[c].h * leaves[c].h);
+}
+
+void QuadtreeFluidSim::addVelocity(int x, int y, float amountX, float amountY) {
+    if (isObstacle(x, y)) return;
+    int c = leafAt[clampCoord(x) + clampCoord(y) * size];
+    if (leafSolid[c]) return;
+    float area = static_cast<float>(leaves[c].h * leaves[c].h);
+    Vx[c] += amountX / area;
+    Vy[c] += amountY / area;
+}
+
+void QuadtreeFluidSim::getDensity(int x, int y, float& outDensity) const {
+    outDensity = density[leafAt[clampCoord(x) + clampCoord(y) * size]];
+}
+
+void QuadtreeFluidSim::getVelocity(int x, int y, float& velX, float& velY) const {
+    int c = leafAt[clampCoord(x) + clampCoord(y) * size];
+    velX = Vx[c];
+    velY = Vy[c];
+}
+
+int QuadtreeFluidSim::getSize() const { return size; }
+float QuadtreeFluidSim::getDiffusion() const { return diffusion; }
+float QuadtreeFluidSim::getViscosity() const { return viscosity; }
+float QuadtreeFluidSim::getDT() const { return dt; }
+
+void QuadtreeFluidSim::setRefinement(float tolerance, int interval) {
+    vorticityTolerance = tolerance;
+    remeshInterval = interval;
+}
+
+int QuadtreeFluidSim::getLeafCount() const {
+    return static_cast<int>(leaves.size());
+}
+
+int QuadtreeFluidSim::getLeafSize(int x, int y) const {
+    return leaves[leafAt[clampCoord(x) + clampCoord(y) * size]].h;
+}
+
+// Face list per leaf. With 2:1 balance a side touches either one neighbour
+// of the same or twice the size, or two neighbours of half the size.
+void QuadtreeFluidSim::buildNeighbours() {
+    const int count = static_cast<int>(leaves.size());
+    faceStart.assign(count + 1, 0);
+    faces.clear();
+    faces.reserve(count * 5);
+
+    for (int c = 0; c < count; c++) {
+        faceStart[c] = static_cast<int>(faces.size());
+        const Leaf& leaf = leaves[c];
+        const int h = leaf.h;
+        for (int side = 0; side < 4; side++) {
+            // First finest cell just outside this side, and the step along it.
+            int px = side == 0 ? leaf.x - 1 : side == 1 ? leaf.x + h : leaf.x;
+            int py = side == 2 ? leaf.y - 1 : side == 3 ? leaf.y + h : leaf.y;
+            int ax = side < 2 ? 0 : 1;
+            int ay = side < 2 ? 1 : 0;
+
+            if (px < 0 || py < 0 || px >= size || py >= size) {
+                Face face = { -1, side, static_cast<float>(h), 1.0f, 0.5f * h };
+                faces.push_back(face);
+                continue;
+            }
+
+            int n = leafAt[px + py * size];
+            int hn = leaves[n].h;
+            if (hn >= h) {
+                Face face = { n, side, static_cast<float>(h), 2.0f * h / (h + hn), 0.5f * hn };
+                faces.push_back(face);
+            }
+            else {
+                for (int k = 0; k < h; k += hn) {
+                    int m = leafAt[(px + ax * k) + (py + ay * k) * size];
+                    float len = static_cast<float>(leaves[m].h);
+                    Face face = { m, side, len, 2.0f * len / (h + leaves[m].h), 0.5f * leaves[m].h };
+                    faces.push_back(face);
+                }
+            }
+        }
+    }
+    faceStart[count] = static_cast<int>(faces.size());
+}
+
+// Chamfer distance to the nearest solid cell, then a min-pyramid so the
+// closest solid inside any aligned block is a single lookup.
+void QuadtreeFluidSim::updateSolidDistance() {
+    const float far = std::numeric_limits<float>::max() * 0.25f;
+    const float diag = 1.41421356f;
+    solidDist.assign(levels, std::vector<float>());
+    std::vector<float>& dist = solidDist[0];
+    dist.assign(size * size, far);
+    for (int idx = 0; idx < size * size; idx++) {
+        if (obstacles[idx]) dist[idx] = 0.0f;
+    }
+
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
+            float& d = dist[i + j * size];
+            if (i > 0) d = std::min(d, dist[i - 1 + j * size] + 1.0f);
+            if (j > 0) {
+                d = std::min(d, dist[i + (j - 1) * size] + 1.0f);
+                if (i > 0) d = std::min(d, dist[i - 1 + (j - 1) * size] + diag);
+                if (i < size - 1) d = std::min(d, dist[i + 1 + (j - 1) * size] + diag);
+            }
+        }
+    }
+    for (int j = size - 1; j >= 0; j--) {
+        for (int i = size - 1; i >= 0; i--) {
+            float& d = dist[i + j * size];
+            if (i < size - 1) d = std::min(d, dist[i + 1 + j * size] + 1.0f);
+            if (j < size - 1) {
+                d = std::min(d, dist[i + (j + 1) * size] + 1.0f);
+                if (i < size - 1) d = std::min(d, dist[i + 1 + (j + 1) * size] + diag);
+                if (i > 0) d = std::min(d, dist[i - 1 + (j + 1) * size] + diag);
+            }
+        }
+    }
+
+    for (int l = 1; l < levels; l++) {
+        const int n = size >> l;
+        const std::vector<float>& fine = solidDist[l - 1];
+        std::vector<float>& coarse = solidDist[l];
+        coarse.resize(n * n);
+        for (int j = 0; j < n; j++) {
+            for (int i = 0; i < n; i++) {
+                int f = 2 * i + 2 * j * 2 * n;
+                coarse[i + j * n] = std::min(std::min(fine[f], fine[f + 1]),
+                                             std::min(fine[f + 2 * n], fine[f + 2 * n + 1]));
+            }
+        }
+    }
+}
+
+// Largest leaf allowed for a block: at most half its distance to a solid,
+// which keeps single cells in a band around bodies and grades outwards.
+int QuadtreeFluidSim::solidLimit(int x, int y, int h) const {
+    int level = levelOf(h);
+    int n = size >> level;
+    float d = solidDist[level][(x >> level) + (y >> level) * n];
+    int limit = 1;
+    while (limit < maxLeafSize && 2 * limit <= 0.5f * d) limit *= 2;
+    return limit;
+}
+
+// Value on one side of leaf c, interpolated between the cell centres and
+// averaged over the face segments. Domain edges use the leaf value.
+float QuadtreeFluidSim::faceValue(const std::vector<float>& field, int c, int side) const {
+    const float half = 0.5f * leaves[c].h;
+    float sum = 0.0f;
+    float length = 0.0f;
+    for (int k = faceStart[c]; k < faceStart[c + 1]; k++) {
+        const Face& f = faces[k];
+        if (f.side != side) continue;
+        if (f.nbr < 0) return field[c];
+        sum += f.length * (field[c] * f.nbrHalf + field[f.nbr] * half) / (half + f.nbrHalf);
+        length += f.length;
+    }
+    return length > 0.0f ? sum / length : field[c];
+}
+
+float QuadtreeFluidSim::vorticity(int c) const {
+    float scale = static_cast<float>(size) / leaves[c].h;
+    return scale * ((faceValue(Vy, c, 1) - faceValue(Vy, c, 0)) - (faceValue(Vx, c, 3) - faceValue(Vx, c, 2)));
+}
+
+// Bilinear weights for a point, on the lattice of the leaf containing it;
+// the four lattice centres may land in leaves one level finer or coarser.
+// Returns false when a corner is solid, which blanks the sample as in FluidSim.
+bool QuadtreeFluidSim::stencil(float x, float y, int ids[4], float w[4]) const {
+    x = std::min(std::max(x, 0.5f), size - 0.5f);
+    y = std::min(std::max(y, 0.5f), size - 0.5f);
+
+    const float h = static_cast<float>(leaves[leafAt[static_cast<int>(x) + static_cast<int>(y) * size]].h);
+    float gx = x / h - 0.5f;
+    float gy = y / h - 0.5f;
+    int i0 = static_cast<int>(std::floor(gx));
+    int j0 = static_cast<int>(std::floor(gy));
+    float s1 = gx - i0;
+    float t1 = gy - j0;
+
+    for (int k = 0; k < 4; k++) {
+        int cx = clampCoord(static_cast<int>((i0 + (k & 1) + 0.5f) * h));
+        int cy = clampCoord(static_cast<int>((j0 + (k >> 1) + 0.5f) * h));
+        ids[k] = leafAt[cx + cy * size];
+        if (leafSolid[ids[k]]) return false;
+    }
+
+    w[0] = (1 - s1) * (1 - t1);
+    w[1] = s1 * (1 - t1);
+    w[2] = (1 - s1) * t1;
+    w[3] = s1 * t1;
+    return true;
+}
+
+void QuadtreeFluidSim::remesh() {
+    if (obstaclesDirty) {
+        updateSolidDistance();
+        obstaclesDirty = false;
+    }
+
+    // Size each current leaf asks for from the vorticity indicator.
+    const int oldCount = static_cast<int>(leaves.size());
+    std::vector<int> wanted(oldCount);
+    for (int c = 0; c < oldCount; c++) {
+        int h = leaves[c].h;
+        float jump = std::fabs(vorticity(c)) * h / size;
+        if (jump > vorticityTolerance) wanted[c] = std::max(1, h / 2);
+        else if (jump < 0.25f * vorticityTolerance) wanted[c] = std::min(maxLeafSize, h * 2);
+        else wanted[c] = h;
+    }
+
+    // Min-pyramid of wanted sizes: the smallest size asked for inside a block.
+    std::vector<std::vector<int>> wantedMin(levels);
+    for (int l = 0; l < levels; l++) {
+        int n = size >> l;
+        wantedMin[l].assign(n * n, maxLeafSize);
+    }
+    for (int c = 0; c < oldCount; c++) {
+        int l = levelOf(leaves[c].h);
+        wantedMin[l][(leaves[c].x >> l) + (leaves[c].y >> l) * (size >> l)] = wanted[c];
+    }
+    for (int l = 1; l < levels; l++) {
+        int n = size >> l;
+        const std::vector<int>& fine = wantedMin[l - 1];
+        for (int j = 0; j < n; j++) {
+            for (int i = 0; i < n; i++) {
+                int f = 2 * i + 2 * j * 2 * n;
+                int m = std::min(std::min(fine[f], fine[f + 1]), std::min(fine[f + 2 * n], fine[f + 2 * n + 1]));
+                wantedMin[l][i + j * n] = std::min(wantedMin[l][i + j * n], m);
+            }
+        }
+    }
+
+    // Rebuild top-down in Z order from the root blocks.
+    std::vector<Leaf> next;
+    std::vector<Leaf> stack;
+    const int roots = size / maxLeafSize;
+    for (int by = 0; by < roots; by++) {
+        for (int bx = 0; bx < roots; bx++) {
+            Leaf root = { bx * maxLeafSize, by * maxLeafSize, maxLeafSize };
+            stack.push_back(root);
+            while (!stack.empty()) {
+                Leaf node = stack.back();
+                stack.pop_back();
+
+                bool split = false;
+                if (node.h > 1) {
+                    int l = levelOf(node.h);
+                    int want = wantedMin[l][(node.x >> l) + (node.y >> l) * (size >> l)];
+                    int owner = leafAt[node.x + node.y * size];
+                    if (leaves[owner].h > node.h) want = std::min(want, wanted[owner]);
+                    split = node.h > want || node.h > solidLimit(node.x, node.y, node.h);
+                }
+
+                if (split) {
+                    int half = node.h / 2;
+                    Leaf ne = { node.x + half, node.y + half, half };
+                    Leaf nw = { node.x, node.y + half, half };
+                    Leaf se = { node.x + half, node.y, half };
+                    Leaf sw = { node.x, node.y, half };
+                    stack.push_back(ne);
+                    stack.push_back(nw);
+                    stack.push_back(se);
+                    stack.push_back(sw);
+                }
+                else {
+                    next.push_back(node);
+                }
+            }
+        }
+    }
+
+    std::vector<int> nextAt(size * size);
+    for (int c = 0; c < static_cast<int>(next.size()); c++) {
+        const Leaf& leaf = next[c];
+        for (int j = leaf.y; j < leaf.y + leaf.h; j++) {
+            std::fill(nextAt.begin() + j * size + leaf.x, nextAt.begin() + j * size + leaf.x + leaf.h, c);
+        }
+    }
+
+    // 2:1 balance: split any neighbour more than twice a leaf's size.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int c = 0; c < static_cast<int>(next.size()); c++) {
+            const Leaf leaf = next[c];
+            const int probes[4][2] = {
+                { leaf.x - 1, leaf.y }, { leaf.x + leaf.h, leaf.y },
+                { leaf.x, leaf.y - 1 }, { leaf.x, leaf.y + leaf.h }
+            };
+            for (int k = 0; k < 4; k++) {
+                int px = probes[k][0];
+                int py = probes[k][1];
+                if (px < 0 || py < 0 || px >= size || py >= size) continue;
+                int n = nextAt[px + py * size];
+                if (next[n].h <= 2 * leaf.h) continue;
+
+                Leaf big = next[n];
+                int half = big.h / 2;
+                Leaf children[4] = {
+                    { big.x, big.y, half }, { big.x + half, big.y, half },
+                    { big.x, big.y + half, half }, { big.x + half, big.y + half, half }
+                };
+                for (int q = 0; q < 4; q++) {
+                    int id = n;
+                    if (q == 0) next[n] = children[0];
+                    else {
+                        id = static_cast<int>(next.size());
+                        next.push_back(children[q]);
+                    }
+                    for (int j = children[q].y; j < children[q].y + half; j++) {
+                        std::fill(nextAt.begin() + j * size + children[q].x,
+                                  nextAt.begin() + j * size + children[q].x + half, id);
+                    }
+                }
+                changed = true;
+            }
+        }
+    }
+
+    // Transfer: refined leaves inherit their parent's value, coarsened
+    // leaves take the area average of what they cover.
+    const int count = static_cast<int>(next.size());
+    std::vector<char> nextSolid(count, 0);
+    std::vector<float> nextDensity(count, 0.0f);
+    std::vector<float> nextVx(count, 0.0f);
+    std::vector<float> nextVy(count, 0.0f);
+    for (int c = 0; c < count; c++) {
+        const Leaf& leaf = next[c];
+        if (leaf.h == 1 && obstacles[leaf.x + leaf.y * size]) {
+            nextSolid[c] = 1;
+            continue;
+        }
+        int owner = leafAt[leaf.x + leaf.y * size];
+        if (leaves[owner].h >= leaf.h) {
+            nextDensity[c] = density[owner];
+            nextVx[c] = Vx[owner];
+            nextVy[c] = Vy[owner];
+        }
+        else {
+            float sumD = 0.0f, sumU = 0.0f, sumV = 0.0f;
+            for (int j = leaf.y; j < leaf.y + leaf.h; j++) {
+                for (int i = leaf.x; i < leaf.x + leaf.h; i++) {
+                    int o = leafAt[i + j * size];
+                    sumD += density[o];
+                    sumU += Vx[o];
+                    sumV += Vy[o];
+                }
+            }
+            float inv = 1.0f / (leaf.h * leaf.h);
+            nextDensity[c] = sumD * inv;
+            nextVx[c] = sumU * inv;
+            nextVy[c] = sumV * inv;
+        }
+    }
+
+    leaves.swap(next);
+    leafAt.swap(nextAt);
+    leafSolid.swap(nextSolid);
+    density.swap(nextDensity);
+    Vx.swap(nextVx);
+    Vy.swap(nextVy);
+    s.assign(count, 0.0f);
+    Vx0.assign(count, 0.0f);
+    Vy0.assign(count, 0.0f);
+    buildNeighbours();
+}
+
+// Implicit diffusion with the finite-volume Laplacian across leaf faces.
+// Walls reflect the normal velocity component (b = 1: x, b = 2: y) and are
+// zero-flux for everything else; solid leaves hold 0, as in FluidSim.
+void QuadtreeFluidSim::diffuse(int b, std::vector<float>& x, const std::vector<float>& x0, float diff) {
+    const int count = static_cast<int>(leaves.size());
+    const float base = dt * diff * size * size;
+    x = x0;
+    for (int k = 0; k < 20; k++) {
+        for (int c = 0; c < count; c++) {
+            if (leafSolid[c]) {
+                x[c] = 0.0f;
+                continue;
+            }
+            float a = base / (leaves[c].h * leaves[c].h);
+            float sum = 0.0f;
+            float weight = 0.0f;
+            for (int f = faceStart[c]; f < faceStart[c + 1]; f++) {
+                const Face& face = faces[f];
+                if (face.nbr < 0) {
+                    bool normal = (b == 1 && face.side < 2) || (b == 2 && face.side >= 2);
+                    if (!normal) continue;
+                    sum -= face.weight * x[c];
+                }
+                else {
+                    sum += face.weight * x[face.nbr];
+                }
+                weight += face.weight;
+            }
+            x[c] = (x0[c] + a * sum) / (1 + a * weight);
+        }
+    }
+}
+
+void QuadtreeFluidSim::advect(std::vector<float>& d, const std::vector<float>& d0,
+                              const std::vector<float>& u, const std::vector<float>& v) {
+    const int count = static_cast<int>(leaves.size());
+    const float dt0 = dt * size;
+    for (int c = 0; c < count; c++) {
+        if (leafSolid[c]) {
+            d[c] = 0.0f;
+            continue;
+        }
+        float cx = leaves[c].x + 0.5f * leaves[c].h;
+        float cy = leaves[c].y + 0.5f * leaves[c].h;
+        int ids[4];
+        float w[4];
+        if (stencil(cx - dt0 * u[c], cy - dt0 * v[c], ids, w)) {
+            d[c] = w[0] * d0[ids[0]] + w[1] * d0[ids[1]] + w[2] * d0[ids[2]] + w[3] * d0[ids[3]];
+        }
+        else {
+            d[c] = 0.0f;
+        }
+    }
+}
+
+// Both components share one backtrace and one stencil lookup.
+void QuadtreeFluidSim::advectVelocity() {
+    const int count = static_cast<int>(leaves.size());
+    const float dt0 = dt * size;
+    for (int c = 0; c < count; c++) {
+        Vx0[c] = 0.0f;
+        Vy0[c] = 0.0f;
+        if (leafSolid[c]) continue;
+        float cx = leaves[c].x + 0.5f * leaves[c].h;
+        float cy = leaves[c].y + 0.5f * leaves[c].h;
+        int ids[4];
+        float w[4];
+        if (stencil(cx - dt0 * Vx[c], cy - dt0 * Vy[c], ids, w)) {
+            Vx0[c] = w[0] * Vx[ids[0]] + w[1] * Vx[ids[1]] + w[2] * Vx[ids[2]] + w[3] * Vx[ids[3]];
+            Vy0[c] = w[0] * Vy[ids[0]] + w[1] * Vy[ids[1]] + w[2] * Vy[ids[2]] + w[3] * Vy[ids[3]];
+        }
+    }
+    Vx.swap(Vx0);
+    Vy.swap(Vy0);
+}
+
+// Pressure solve on the composite grid: face fluxes are interpolated to the
+// shared face, so coarse-fine interfaces conserve mass, and the Poisson
+// stencil uses the same length / distance weights as diffusion.
+void QuadtreeFluidSim::project(std::vector<float>& u, std::vector<float>& v,
+                               std::vector<float>& p, std::vector<float>& div) {
+    const int count = static_cast<int>(leaves.size());
+    for (int c = 0; c < count; c++) {
+        p[c] = 0.0f;
+        if (leafSolid[c]) {
+            div[c] = 0.0f;
+            continue;
+        }
+        const float half = 0.5f * leaves[c].h;
+        float flux = 0.0f;
+        for (int f = faceStart[c]; f < faceStart[c + 1]; f++) {
+            const Face& face = faces[f];
+            if (face.nbr < 0) continue;     // walls carry no normal flow
+            const std::vector<float>& comp = face.side < 2 ? u : v;
+            float value = (comp[c] * face.nbrHalf + comp[face.nbr] * half) / (half + face.nbrHalf);
+            flux += (face.side & 1 ? 1.0f : -1.0f) * face.length * value;
+        }
+        div[c] = -flux / size;
+    }
+
+    for (int k = 0; k < 20; k++) {
+        for (int c = 0; c < count; c++) {
+            if (leafSolid[c]) continue;
+            float sum = 0.0f;
+            float weight = 0.0f;
+            for (int f = faceStart[c]; f < faceStart[c + 1]; f++) {
+                const Face& face = faces[f];
+                if (face.nbr < 0) continue;
+                sum += face.weight * p[face.nbr];
+                weight += face.weight;
+            }
+            if (weight > 0.0f) p[c] = (div[c] + sum) / weight;
+        }
+    }
+
+    for (int c = 0; c < count; c++) {
+        if (leafSolid[c]) continue;
+        float scale = static_cast<float>(size) / leaves[c].h;
+        u[c] -= scale * (faceValue(p, c, 1) - faceValue(p, c, 0));
+        v[c] -= scale * (faceValue(p, c, 3) - faceValue(p, c, 2));
+    }
+}
+
+void QuadtreeFluidSim::step() {
+    if (obstaclesDirty || (remeshInterval > 0 && stepCount % remeshInterval == 0)) {
+        remesh();
+    }
+    stepCount++;
+
+    // Diffuse velocity
+    diffuse(1, Vx0, Vx, viscosity);
+    Vx.swap(Vx0);
+
+    diffuse(2, Vy0, Vy, viscosity);
+    Vy.swap(Vy0);
+
+    // Project velocity
+    project(Vx, Vy, Vx0, Vy0);
+
+    // Advect velocity
+    advectVelocity();
+
+    // Project again
+    project(Vx, Vy, Vx0, Vy0);
+
+    // Diffuse density
+    diffuse(0, s, density, diffusion);
+    density.swap(s);
+
+    // Advect density
+    advect(s, density, Vx, Vy);
+    density.swap(s);
+}
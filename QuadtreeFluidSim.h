@@ -0,0 +1,111 @@
+#pragma once
+#ifndef QUADTREEFLUIDSIM_H
+#define QUADTREEFLUIDSIM_H
+
+#include <vector>
+
+// Stable-fluids solver on an adaptive quadtree. Leaves are refined down to
+// single cells around obstacles and where the vorticity indicator is high,
+// and coarsened up to maxLeafSize in the free stream; neighbouring leaves
+// differ by at most one level. Public coordinates are finest-level cells,
+// so the API matches FluidSim.
+class QuadtreeFluidSim
+{
+public:
+    QuadtreeFluidSim(int size, int maxLeafSize, float diffusion, float viscosity, float dt);
+    ~QuadtreeFluidSim();
+
+    QuadtreeFluidSim(const QuadtreeFluidSim&) = delete;
+    QuadtreeFluidSim& operator=(const QuadtreeFluidSim&) = delete;
+
+    void step();
+    // Amounts are per finest cell: a leaf of h x h cells gains amount / h^2,
+    // so adding to each of its cells raises it by amount, as on FluidSim. A
+    // single call into a coarse leaf is diluted over the whole leaf.
+    void addDensity(int x, int y, float amount);
+    void addVelocity(int x, int y, float amountX, float amountY);
+    void getDensity(int x, int y, float& density) const;
+    void getVelocity(int x, int y, float& velX, float& velY) const;
+    int getSize() const;
+    float getDiffusion() const;
+    float getViscosity() const;
+    float getDT() const;
+
+    // Obstacle support
+    void setObstacle(int x, int y, bool solid);
+    void clearObstacles();
+    bool isObstacle(int x, int y) const;
+
+    // Refinement control. A leaf is split while the velocity jump across it
+    // (|vorticity| * leaf width) exceeds vorticityTolerance, and merged once
+    // all four siblings are below a quarter of it. The tree is rebuilt every
+    // remeshInterval steps and whenever the obstacles change.
+    void setRefinement(float vorticityTolerance, int remeshInterval);
+    void remesh();
+    int getLeafCount() const;
+    int getLeafSize(int x, int y) const;
+
+private:
+    struct Leaf
+    {
+        int x, y;       // lower-left finest cell
+        int h;          // edge length in finest cells
+    };
+
+    // One face segment between a leaf and a neighbour (or the domain edge).
+    struct Face
+    {
+        int nbr;        // neighbour leaf, -1 on the domain boundary
+        int side;       // 0 = west, 1 = east, 2 = south, 3 = north
+        float length;   // face length in finest cells
+        float weight;   // length / centre distance
+        float nbrHalf;  // half the neighbour's edge length
+    };
+
+    int size;           // finest cells per axis
+    int maxLeafSize;
+    int levels;         // leaf sizes 1, 2, ..., maxLeafSize
+    float dt;
+    float diffusion;
+    float viscosity;
+
+    float vorticityTolerance;
+    int remeshInterval;
+    int stepCount;
+    bool obstaclesDirty;
+
+    std::vector<Leaf> leaves;
+    std::vector<char> leafSolid;
+    std::vector<int> faceStart;     // faces of leaf c: [faceStart[c], faceStart[c + 1])
+    std::vector<Face> faces;
+    std::vector<int> leafAt;        // finest cell -> owning leaf
+
+    std::vector<float> density;
+    std::vector<float> s;           // temp density
+    std::vector<float> Vx;
+    std::vector<float> Vy;
+    std::vector<float> Vx0;
+    std::vector<float> Vy0;
+
+    bool* obstacles;                            // finest-level obstacle grid
+    std::vector<std::vector<float>> solidDist;  // per level: min distance to a solid cell
+
+    int clampCoord(int v) const;
+    int levelOf(int h) const;
+
+    void buildNeighbours();
+    void updateSolidDistance();
+    int solidLimit(int x, int y, int h) const;
+    float faceValue(const std::vector<float>& field, int c, int side) const;
+    float vorticity(int c) const;
+    bool stencil(float x, float y, int ids[4], float w[4]) const;
+
+    void diffuse(int b, std::vector<float>& x, const std::vector<float>& x0, float diff);
+    void advect(std::vector<float>& d, const std::vector<float>& d0,
+                const std::vector<float>& velocX, const std::vector<float>& velocY);
+    void advectVelocity();
+    void project(std::vector<float>& velocX, std::vector<float>& velocY,
+                 std::vector<float>& p, std::vector<float>& div);
+};
+
+#endif
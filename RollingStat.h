@@ -0,0 +1,50 @@
+#pragma once
+#ifndef ROLLINGSTAT_H
+#define ROLLINGSTAT_H
+
+// Last value, mean and maximum over a fixed window of recent samples.
+class RollingStat
+{
+public:
+    static const int window = 64;
+
+    RollingStat() : count(0), next(0), lastValue(0.0) {}
+
+    void push(double value) {
+        samples[next] = value;
+        next = (next + 1) % window;
+        if (count < window) count++;
+        lastValue = value;
+    }
+
+    void reset() {
+        count = 0;
+        next = 0;
+        lastValue = 0.0;
+    }
+
+    int size() const { return count; }
+    double last() const { return lastValue; }
+
+    double mean() const {
+        double sum = 0.0;
+        for (int i = 0; i < count; i++) sum += samples[i];
+        return count ? sum / count : 0.0;
+    }
+
+    double max() const {
+        double best = count ? samples[0] : 0.0;
+        for (int i = 1; i < count; i++) {
+            if (samples[i] > best) best = samples[i];
+        }
+        return best;
+    }
+
+private:
+    double samples[window];
+    int count;
+    int next;
+    double lastValue;
+};
+
+#endif
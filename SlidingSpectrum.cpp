@@ -0,0 +1,93 @@
+#include "SlidingSpectrum.h"
+
+#include <algorithm>
+#include <cmath>
+
+SlidingSpectrum::SlidingSpectrum(int window, double interval, double minFrequency, double maxFrequency,
+                                 double tolerance)
+    : window(std::max(window, 4)), interval(interval), tolerance(tolerance)
+{
+    // Bin k has frequency k / (window * interval); the DC bin is never kept.
+    const double span = this->window * interval;
+    firstBin = std::max(1, static_cast<int>(std::ceil(minFrequency * span)));
+    int lastBin = std::min(this->window / 2, static_cast<int>(std::floor(maxFrequency * span)));
+    const double pi = 3.14159265358979323846;
+    for (int k = firstBin; k <= lastBin; k++) {
+        twiddle.push_back(std::polar(1.0, 2.0 * pi * k / this->window));
+    }
+    bins.resize(twiddle.size());
+    history.resize(this->window);
+    reset();
+}
+
+void SlidingSpectrum::reset() {
+    std::fill(bins.begin(), bins.end(), std::complex<double>());
+    std::fill(history.begin(), history.end(), 0.0f);
+    next = 0;
+    count = 0;
+    frequency = 0.0;
+    amplitude = 0.0;
+    settled = 0.0;
+    stableSamples = 0;
+}
+
+// X_k <- (X_k + x_new - x_old) e^(2 pi i k / N), with the strongest bin
+// picked up in the same pass.
+void SlidingSpectrum::push(float value) {
+    const double delta = static_cast<double>(value) - history[next];
+    history[next] = value;
+    next = next + 1 == window ? 0 : next + 1;
+    count++;
+
+    int best = -1;
+    double bestPower = 0.0;
+    for (size_t k = 0; k < bins.size(); k++) {
+        bins[k] = (bins[k] + delta) * twiddle[k];
+        double power = std::norm(bins[k]);
+        if (power > bestPower) {
+            bestPower = power;
+            best = static_cast<int>(k);
+        }
+    }
+    if (count < window || best < 0) return;
+
+    double offset = 0.0;
+    if (best > 0 && best + 1 < static_cast<int>(bins.size())) {
+        double a = std::abs(bins[best - 1]);
+        double b = std::abs(bins[best]);
+        double c = std::abs(bins[best + 1]);
+        double curvature = a - 2.0 * b + c;
+        if (curvature < 0.0) offset = 0.5 * (a - c) / curvature;
+    }
+    frequency = (firstBin + best + offset) / (window * interval);
+    amplitude = 2.0 * std::sqrt(bestPower) / window;
+
+    if (settled == 0.0 || std::fabs(frequency - settled) > tolerance * settled) {
+        settled = frequency;
+        stableSamples = 0;
+    }
+    else {
+        stableSamples++;
+    }
+}
+
+int SlidingSpectrum::getWindow() const { return window; }
+double SlidingSpectrum::getInterval() const { return interval; }
+int SlidingSpectrum::getBinCount() const { return static_cast<int>(bins.size()); }
+
+double SlidingSpectrum::getBinFrequency(int bin) const {
+    return (firstBin + bin) / (window * interval);
+}
+
+double SlidingSpectrum::getBinAmplitude(int bin) const {
+    if (bin < 0 || bin >= static_cast<int>(bins.size())) return 0.0;
+    return 2.0 * std::abs(bins[bin]) / window;
+}
+
+bool SlidingSpectrum::isFull() const { return count >= window; }
+double SlidingSpectrum::getFrequency() const { return frequency; }
+double SlidingSpectrum::getAmplitude() const { return amplitude; }
+
+bool SlidingSpectrum::isConverged() const {
+    return count >= window && stableSamples >= window / 2;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#ifndef SLIDINGSPECTRUM_H
+#define SLIDINGSPECTRUM_H
+
+#include <complex>
+#include <vector>
+
+// Sliding DFT over the last window samples of a signal sampled every
+// interval, kept only for the bins whose frequency k / (window * interval)
+// lies in [minFrequency, maxFrequency]. Each push() updates every kept bin
+// and tracks the strongest, so the dominant frequency (refined between bins
+// by a parabola through the neighbouring magnitudes) and its amplitude are
+// current after every sample. A push costs O(kept bins), up to window / 2
+// when the band reaches Nyquist. The estimate has converged once
+// the window is full and the frequency has stayed within tolerance
+// (relative) of where it settled for half a window.
+class SlidingSpectrum
+{
+public:
+    SlidingSpectrum(int window, double interval, double minFrequency, double maxFrequency,
+                    double tolerance = 0.01);
+
+    void push(float value);
+    void reset();
+
+    int getWindow() const;
+    double getInterval() const;
+    int getBinCount() const;
+    double getBinFrequency(int bin) const;
+    double getBinAmplitude(int bin) const;
+    bool isFull() const;
+    double getFrequency() const;    // dominant, 0 until the window is full
+    double getAmplitude() const;    // of the dominant sinusoid
+    bool isConverged() const;
+
+private:
+    int window;
+    double interval;
+    double tolerance;
+    int firstBin;
+    std::vector<std::complex<double>> bins;
+    std::vector<std::complex<double>> twiddle;  // e^(2 pi i k / window)
+    std::vector<float> history;                 // last window samples, circular
+    int next;
+    long long count;
+    double frequency;
+    double amplitude;
+    double settled;                 // frequency the estimate settled on
+    long long stableSamples;        // samples since it last left the band
+};
+
+#endif
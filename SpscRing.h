@@ -0,0 +1,60 @@
+#pragma once
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Fixed-capacity lock-free ring for one producer thread and one consumer
+// thread. push() fails instead of overwriting when the ring is full.
+template <class T>
+class SpscRing
+{
+public:
+    // Capacity is rounded up to a power of two.
+    explicit SpscRing(size_t capacity) : head(0), tail(0) {
+        size_t rounded = 1;
+        while (rounded < capacity) rounded <<= 1;
+        slots.resize(rounded);
+        mask = rounded - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer side.
+    bool push(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) > mask) return false;
+        slots[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.
+    bool pop(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        item = slots[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+    size_t capacity() const { return mask + 1; }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    // Producer and consumer indices on separate cache lines.
+    std::atomic<size_t> head;
+    char headPad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char tailPad[64 - sizeof(std::atomic<size_t>)];
+};
+
+#endif
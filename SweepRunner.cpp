@@ -0,0 +1,184 @@
+// Headless parameter sweep: runs the wind-tunnel setup from main.cpp for every
+// combination in a sweep spec, one FluidSim per task on a work-stealing pool,
+// and writes one CSV row per run.
+//
+// Usage: aerodynamics_sweep <spec> [output.csv] [threads]
+//
+// The spec lists values per key, one key per line ('#' starts a comment):
+//
+//     sizes          64 128 256
+//     inflow         10 30        velocity added at the inlet every step
+//     obstacle_size  0.125        fractions of the grid size; main.cpp uses
+//     obstacle_x     0.5          simSize / 8, simSize / 2 and a centred
+//     obstacle_y     0.5          obstacle (obstacle_y is its centre)
+//     steps          200
+//
+// Missing keys take the main.cpp values; sizes and steps must be whole
+// numbers, sizes at least 3 and steps not negative. Drag and lift are the
+// force on the obstacle, pressure plus viscous (FluidSim::getBodyForce),
+// averaged over the second half of the steps.
+
+#include "FluidSim.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct SweepRun
+{
+    int size;
+    float inflow;
+    float obstacleSize;
+    float obstacleX;
+    float obstacleY;
+    int steps;
+
+    float drag;
+    float lift;
+    double seconds;
+};
+
+static bool readSpec(const char* path, std::map<std::string, std::vector<float>>& spec) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open sweep spec " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string key;
+        if (!(words >> key)) continue;
+        std::vector<float> values;
+        float value;
+        while (words >> value) values.push_back(value);
+        if (values.empty()) {
+            std::cerr << "No values for '" << key << "' in " << path << std::endl;
+            return false;
+        }
+        for (float v : values) {
+            if ((key == "sizes" || key == "steps") && v != std::floor(v)) {
+                std::cerr << "Invalid value " << v << " for '" << key << "' in " << path
+                          << " (" << key << " must be whole numbers)" << std::endl;
+                return false;
+            }
+            if ((key == "sizes" && v < 3.0f) || (key == "steps" && v < 0.0f)) {
+                std::cerr << "Invalid value " << v << " for '" << key << "' in " << path
+                          << (key == "sizes" ? " (sizes must be at least 3)" : " (steps must not be negative)")
+                          << std::endl;
+                return false;
+            }
+        }
+        spec[key] = values;
+    }
+    return true;
+}
+
+static void runOne(SweepRun& run) {
+    const int simSize = run.size;
+    FluidSim fluid(simSize, 0.00001f, 0.0000001f, 0.2f);
+
+    // Wind tunnel walls
+    fluid.setObstacleRect(0, 0, simSize, 1);
+    fluid.setObstacleRect(0, simSize - 1, simSize, simSize);
+
+    int obsSize = std::max(1, static_cast<int>(run.obstacleSize * simSize));
+    int obsStartX = static_cast<int>(run.obstacleX * simSize);
+    int obsEndX = obsStartX + obsSize;
+    int obsStartY = static_cast<int>(run.obstacleY * simSize) - obsSize / 2;
+    int obsEndY = obsStartY + obsSize;
+    fluid.setObstacleRect(obsStartX, obsStartY, obsEndX, obsEndY, 1);
+
+    int injectionStart = simSize / 3;
+    int injectionEnd = 2 * simSize / 3;
+    fluid.addPersistentSource(2, injectionStart, 3, injectionEnd, 500.0f, run.inflow, 0.0f);
+    auto start = std::chrono::steady_clock::now();
+
+    double drag = 0.0, lift = 0.0;
+    int samples = 0;
+    for (int step = 0; step < run.steps; step++) {
+        fluid.step();
+
+        if (step >= run.steps / 2) {
+            FluidSim::BodyForce force = fluid.getBodyForce(1);
+            drag += force.x;
+            lift += force.y;
+            samples++;
+        }
+    }
+
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    run.drag = samples ? static_cast<float>(drag / samples) : 0.0f;
+    run.lift = samples ? static_cast<float>(lift / samples) : 0.0f;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <spec> [output.csv] [threads]" << std::endl;
+        return 1;
+    }
+
+    std::map<std::string, std::vector<float>> spec;
+    spec["sizes"] = { 128 };
+    spec["inflow"] = { 30.0f };
+    spec["obstacle_size"] = { 0.125f };
+    spec["obstacle_x"] = { 0.5f };
+    spec["obstacle_y"] = { 0.5f };
+    spec["steps"] = { 200 };
+    if (!readSpec(argv[1], spec)) return 1;
+
+    std::vector<SweepRun> runs;
+    for (float size : spec["sizes"])
+    for (float inflow : spec["inflow"])
+    for (float obstacleSize : spec["obstacle_size"])
+    for (float obstacleX : spec["obstacle_x"])
+    for (float obstacleY : spec["obstacle_y"])
+    for (float steps : spec["steps"]) {
+        SweepRun run = SweepRun();
+        run.size = static_cast<int>(size);
+        run.inflow = inflow;
+        run.obstacleSize = obstacleSize;
+        run.obstacleX = obstacleX;
+        run.obstacleY = obstacleY;
+        run.steps = static_cast<int>(steps);
+        runs.push_back(run);
+    }
+
+    int threads = argc > 3 ? std::atoi(argv[3]) : 0;
+    WorkerPool pool(threads);
+    std::cerr << "Running " << runs.size() << " configurations on "
+              << pool.getThreadCount() << " threads" << std::endl;
+
+    // Larger grids first, so the long runs start early and the short ones
+    // fill in the gaps by stealing.
+    std::stable_sort(runs.begin(), runs.end(), [](const SweepRun& a, const SweepRun& b) {
+        return static_cast<long long>(a.size) * a.size * a.steps > static_cast<long long>(b.size) * b.size * b.steps;
+    });
+    pool.runTasks(static_cast<int>(runs.size()), [&](int i) { runOne(runs[i]); });
+
+    std::ofstream file;
+    if (argc > 2) {
+        file.open(argv[2]);
+        if (!file) {
+            std::cerr << "Cannot write " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = argc > 2 ? file : std::cout;
+    out << "size,inflow,obstacle_size,obstacle_x,obstacle_y,steps,drag,lift,seconds\n";
+    for (const SweepRun& run : runs) {
+        out << run.size << ',' << run.inflow << ',' << run.obstacleSize << ','
+            << run.obstacleX << ',' << run.obstacleY << ',' << run.steps << ','
+            << run.drag << ',' << run.lift << ',' << run.seconds << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "TiledField.h"
+#include <cstring>
+
+TiledField::TiledField(int size)
+    : size(size), tilesPerRow((size + tileSize - 1) / tileSize), allocated(0)
+{
+    tiles = new float*[tilesPerRow * tilesPerRow]();
+}
+
+TiledField::~TiledField() {
+    clear();
+    for (float* t : freeTiles) {
+        delete[] t;
+    }
+    delete[] tiles;
+}
+
+float* TiledField::ensureTile(int t) {
+    if (!tiles[t]) {
+        if (!freeTiles.empty()) {
+            tiles[t] = freeTiles.back();
+            freeTiles.pop_back();
+            memset(tiles[t], 0, tileCells * sizeof(float));
+        }
+        else {
+            tiles[t] = new float[tileCells]();
+        }
+        allocated++;
+    }
+    return tiles[t];
+}
+
+void TiledField::releaseTile(int t) {
+    if (tiles[t]) {
+        freeTiles.push_back(tiles[t]);
+        tiles[t] = nullptr;
+        allocated--;
+    }
+}
+
+void TiledField::clear() {
+    int count = getTileCount();
+    for (int t = 0; t < count; t++) {
+        releaseTile(t);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef TILEDFIELD_H
+#define TILEDFIELD_H
+
+#include <vector>
+
+// Square scalar field stored as fixed-size tiles that are allocated on
+// demand. Cells of unallocated tiles read as zero.
+class TiledField
+{
+public:
+    static const int tileShift = 4;
+    static const int tileSize = 1 << tileShift;   // cells per tile edge
+    static const int tileCells = tileSize * tileSize;
+
+    explicit TiledField(int size);
+    ~TiledField();
+
+    TiledField(const TiledField&) = delete;
+    TiledField& operator=(const TiledField&) = delete;
+
+    int getSize() const { return size; }
+    int getTilesPerRow() const { return tilesPerRow; }
+    int getTileCount() const { return tilesPerRow * tilesPerRow; }
+
+    int tileIndex(int x, int y) const {
+        return (y >> tileShift) * tilesPerRow + (x >> tileShift);
+    }
+    static int cellOffset(int x, int y) {
+        return (y & (tileSize - 1)) * tileSize + (x & (tileSize - 1));
+    }
+
+    // Unclamped read; x and y must lie inside the grid.
+    float get(int x, int y) const {
+        const float* t = tiles[tileIndex(x, y)];
+        return t ? t[cellOffset(x, y)] : 0.0f;
+    }
+
+    float* tile(int t) const { return tiles[t]; }
+    float* ensureTile(int t);       // allocates a zeroed tile on first use
+    void releaseTile(int t);        // drops the tile back to the free list
+    void clear();
+
+    int getAllocatedTiles() const { return allocated; }
+
+private:
+    int size;
+    int tilesPerRow;
+    int allocated;
+    float** tiles;
+    std::vector<float*> freeTiles;
+};
+
+#endif
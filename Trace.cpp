@@ -0,0 +1,128 @@
+#include "Trace.h"
+#include "SpscRing.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent
+{
+    const char* name;
+    long long start;
+    long long end;
+};
+
+struct TraceThread
+{
+    explicit TraceThread(int id) : id(id), inUse(true), events(Trace::eventsPerThread) {}
+    int id;
+    bool inUse;         // leased by a live thread; guarded by the registry mutex
+    SpscRing<TraceEvent> events;
+};
+
+static std::atomic<bool> traceEnabled(false);
+static std::atomic<long long> droppedEvents(0);
+
+// Rings are leased on a thread's first event and handed back when the
+// thread exits, so the number of rings follows the number of threads alive
+// at once rather than the number ever started. A returned ring keeps its
+// undrained events and the next thread to lease it appends to them. The
+// mutex also serialises the consumers.
+static std::mutex& registryMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::vector<std::unique_ptr<TraceThread>>& registry() {
+    static std::vector<std::unique_ptr<TraceThread>> threads;
+    return threads;
+}
+
+void Trace::setEnabled(bool enabled) {
+    now();  // pin the epoch before the first event
+    traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Trace::isEnabled() {
+    return traceEnabled.load(std::memory_order_relaxed);
+}
+
+long long Trace::now() {
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - epoch).count();
+}
+
+// Hands the thread's ring back from its thread_local destructor.
+struct RingLease
+{
+    TraceThread* ring = nullptr;
+    ~RingLease() {
+        if (!ring) return;
+        std::lock_guard<std::mutex> lock(registryMutex());
+        ring->inUse = false;
+    }
+};
+
+static TraceThread* leaseRing() {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    std::vector<std::unique_ptr<TraceThread>>& threads = registry();
+    for (const std::unique_ptr<TraceThread>& thread : threads) {
+        if (!thread->inUse) {
+            thread->inUse = true;
+            return thread.get();
+        }
+    }
+    threads.emplace_back(new TraceThread(static_cast<int>(threads.size())));
+    return threads.back().get();
+}
+
+void Trace::record(const char* name, long long startNs, long long endNs) {
+    thread_local RingLease lease;
+    if (!lease.ring) lease.ring = leaseRing();
+    TraceThread* self = lease.ring;
+    TraceEvent event = { name, startNs, endNs };
+    if (!self->events.push(event)) {
+        droppedEvents.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool Trace::writeChromeJson(const char* path) {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    std::lock_guard<std::mutex> lock(registryMutex());
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (const std::unique_ptr<TraceThread>& thread : registry()) {
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id
+            << ",\"args\":{\"name\":\"thread " << thread->id << "\"}}";
+        first = false;
+
+        TraceEvent event;
+        while (thread->events.pop(event)) {
+            out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+                << ",\"ts\":" << event.start * 1e-3 << ",\"dur\":" << (event.end - event.start) * 1e-3 << "}";
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
+}
+
+void Trace::clear() {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    for (const std::unique_ptr<TraceThread>& thread : registry()) {
+        TraceEvent event;
+        while (thread->events.pop(event)) {}
+    }
+    droppedEvents.store(0, std::memory_order_relaxed);
+}
+
+long long Trace::getDroppedEvents() {
+    return droppedEvents.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#ifndef TRACE_H
+#define TRACE_H
+
+// Timeline tracing in the Chrome trace event format (chrome://tracing,
+// ui.perfetto.dev). Each thread records complete events into its own
+// lock-free ring; writeChromeJson() drains every ring on demand. Recording
+// is off until setEnabled(true); TRACE_SCOPE compiles to nothing with
+// FLUIDSIM_NO_TRACE.
+class Trace
+{
+public:
+    static const int eventsPerThread = 1 << 16;
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    // Nanoseconds since the first call.
+    static long long now();
+
+    // Adds a complete event on the calling thread. name must outlive the
+    // trace (string literals). Events that do not fit are counted as dropped.
+    static void record(const char* name, long long startNs, long long endNs);
+
+    // Drains all rings into a Chrome trace JSON file; false if it cannot be
+    // written. clear() drains them without writing.
+    static bool writeChromeJson(const char* path);
+    static void clear();
+    static long long getDroppedEvents();
+};
+
+// Records the enclosing scope as one event while tracing is enabled.
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name)
+        : name(name), start(Trace::isEnabled() ? Trace::now() : -1) {}
+    ~TraceScope() {
+        if (start >= 0) Trace::record(name, start, Trace::now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    long long start;
+};
+
+#ifdef FLUIDSIM_NO_TRACE
+#define TRACE_SCOPE(name)
+#else
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#endif
+
+#endif
@@ -0,0 +1,132 @@
+#include "WorkerPool.h"
+#include "Trace.h"
+#include <algorithm>
+#include <memory>
+
+WorkerPool::WorkerPool(int threads)
+    : job(nullptr), jobBegin(0), jobEnd(0), jobChunk(1), nextChunk(0),
+      busyWorkers(0), generation(0), stopping(false)
+{
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (threads <= 0) threads = 1;
+    }
+    // The calling thread takes part in every parallelFor, so spawn one less.
+    for (int t = 1; t < threads; t++) {
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int WorkerPool::getThreadCount() const {
+    return static_cast<int>(workers.size()) + 1;
+}
+
+void WorkerPool::runChunks() {
+    for (;;) {
+        int lo = jobBegin + nextChunk.fetch_add(1) * jobChunk;
+        if (lo >= jobEnd) break;
+        int hi = std::min(lo + jobChunk, jobEnd);
+        TRACE_SCOPE("parallelFor chunk");
+        (*job)(lo, hi);
+    }
+}
+
+void WorkerPool::workerLoop() {
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+
+        runChunks();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0) finished.notify_one();
+    }
+}
+
+void WorkerPool::parallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain) {
+    if (end <= begin) return;
+    int count = end - begin;
+    int threads = getThreadCount();
+    if (threads == 1 || count <= grain) {
+        body(begin, end);
+        return;
+    }
+
+    // A few chunks per thread keeps the load balanced when rows differ in cost.
+    int chunk = std::max(grain, (count + threads * 4 - 1) / (threads * 4));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &body;
+        jobBegin = begin;
+        jobEnd = end;
+        jobChunk = chunk;
+        nextChunk.store(0);
+        busyWorkers = static_cast<int>(workers.size());
+        generation++;
+    }
+    wake.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+bool WorkerPool::popFront(TaskQueue& queue, int& item) {
+    std::lock_guard<std::mutex> lock(queue.lock);
+    if (queue.items.empty()) return false;
+    item = queue.items.front();
+    queue.items.pop_front();
+    return true;
+}
+
+bool WorkerPool::popBack(TaskQueue& queue, int& item) {
+    std::lock_guard<std::mutex> lock(queue.lock);
+    if (queue.items.empty()) return false;
+    item = queue.items.back();
+    queue.items.pop_back();
+    return true;
+}
+
+void WorkerPool::runTasks(int count, const std::function<void(int)>& task) {
+    if (count <= 0) return;
+    int queueCount = std::min(getThreadCount(), count);
+    std::unique_ptr<TaskQueue[]> queues(new TaskQueue[queueCount]);
+    for (int i = 0; i < count; i++) {
+        queues[static_cast<long long>(i) * queueCount / count].items.push_back(i);
+    }
+
+    // No task is queued once this starts, so a thread whose own queue and
+    // every victim are empty can stop.
+    parallelFor(0, queueCount, [&](int lo, int hi) {
+        for (int self = lo; self < hi; self++) {
+            for (;;) {
+                int item;
+                bool found = popFront(queues[self], item);
+                for (int k = 1; !found && k < queueCount; k++) {
+                    found = popBack(queues[(self + k) % queueCount], item);
+                }
+                if (!found) break;
+                TRACE_SCOPE("task");
+                task(item);
+            }
+        }
+    });
+}
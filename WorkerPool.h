@@ -0,0 +1,70 @@
+#pragma once
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent thread pool used by the solver kernels. parallelFor splits a
+// range into chunks that workers (and the calling thread) claim dynamically;
+// runTasks schedules independent, unevenly sized tasks with work stealing.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(int threads = 0);   // 0 = hardware concurrency
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int getThreadCount() const;
+
+    // Calls body(lo, hi) over [begin, end) in chunks of at least grain items.
+    // Blocks until the whole range has been processed. Not reentrant: the
+    // pool runs one job at a time, so body must not call parallelFor or
+    // runTasks on the same pool. That call would replace the running job
+    // and wait on workers that are busy with it, which deadlocks. Nest work
+    // through a separate pool instead.
+    void parallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain = 1);
+
+    // Calls task(i) for every i in [0, count). Each thread starts on its own
+    // contiguous block of tasks and, once that is drained, steals from the
+    // back of the other blocks. Blocks until every task has run. Built on
+    // parallelFor and just as non-reentrant: a task must not call back into
+    // this pool. Objects a task creates, such as a FluidSim3D with its own
+    // pool, are fine.
+    void runTasks(int count, const std::function<void(int)>& task);
+
+private:
+    struct TaskQueue
+    {
+        std::mutex lock;
+        std::deque<int> items;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    const std::function<void(int, int)>* job;
+    int jobBegin;
+    int jobEnd;
+    int jobChunk;
+    std::atomic<int> nextChunk;
+    int busyWorkers;
+    unsigned generation;
+    bool stopping;
+
+    void workerLoop();
+    void runChunks();
+    static bool popFront(TaskQueue& queue, int& item);
+    static bool popBack(TaskQueue& queue, int& item);
+};
+
+#endif
@@ -10,10 +10,9 @@
 #include <vector>
 #include <cmath>
 #include "FluidSim.h"
+#include "Trace.h"
 
 const int simSize = 128;
-// Increased time step and reduced viscosity for faster flow
-FluidSim fluid(simSize, 0.00001f, 0.0000001f, 0.2f);
 
 // Shader sources for obstacle
 const char* obstacleVertexShaderSource = R"(#version 330 core
@@ -54,6 +53,9 @@ void main()
 
 int main()
 {
+    // Increased time step and reduced viscosity for faster flow
+    FluidSim fluid(simSize, 0.00001f, 0.0000001f, 0.2f);
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -76,10 +78,8 @@ int main()
     glDisable(GL_DEPTH_TEST);
 
     // Set up wind tunnel boundaries
-    for (int i = 0; i < simSize; i++) {
-        fluid.setObstacle(i, 0, true);           // Bottom wall
-        fluid.setObstacle(i, simSize - 1, true);    // Top wall
-    }
+    fluid.setObstacleRect(0, 0, simSize, 1);                    // Bottom wall
+    fluid.setObstacleRect(0, simSize - 1, simSize, simSize);    // Top wall
 
     // Set up obstacle - centered in wind tunnel
     int obsSize = simSize / 8;
@@ -87,12 +87,8 @@ int main()
     int obsEndX = obsStartX + obsSize;
     int obsStartY = simSize / 2 - obsSize / 2;
     int obsEndY = obsStartY + obsSize;
-
-    for (int i = obsStartX; i < obsEndX; ++i) {
-        for (int j = obsStartY; j < obsEndY; ++j) {
-            fluid.setObstacle(i, j, true);
-        }
-    }
+    fluid.setObstacleRect(obsStartX, obsStartY, obsEndX, obsEndY, 1);
+    fluid.commitObstacles();
 
     // Create obstacle shaders and VAO
     GLuint obstacleShaderProgram = glCreateProgram();
@@ -196,78 +192,105 @@ int main()
     // Add strong initial fluid
     int injectionStart = simSize / 3;
     int injectionEnd = 2 * simSize / 3;
+    fluid.addSource(2, injectionStart, 3, injectionEnd, 3000.0f, 100.0f, 0.0f);
     for (int j = injectionStart; j < injectionEnd; j++) {
-        fluid.addDensity(2, j, 3000.0f);
-        fluid.addVelocity(2, j, 100.0f, 0.0f);
         intensityGrid[2 * simSize + j] = 1.0f;
     }
 
+    // Constant inflow through the middle third of the left edge; the wake
+    // leaves through the right edge instead of reflecting upstream
+    fluid.setInflow(FluidSim::EdgeLeft, 0.1f, 0.0f, 1000.0f, injectionStart, injectionEnd);
+    fluid.setBoundaryType(FluidSim::EdgeRight, FluidSim::BoundaryType::Outflow);
+
+    // Press T to start a timeline capture and T again to write trace.json
+    bool traceKeyDown = false;
+
     // Main loop
     while (!glfwWindowShouldClose(window))
     {
-        // Add constant strong fluid input
-        for (int j = injectionStart; j < injectionEnd; j++) {
-            if (!fluid.isObstacle(2, j)) {
-                fluid.addDensity(2, j, 500.0f);
-                fluid.addVelocity(2, j, 30.0f, 0.0f);
-                intensityGrid[2 * simSize + j] = 1.0f;
+        TRACE_SCOPE("frame");
+        bool traceKey = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+        if (traceKey && !traceKeyDown) {
+            if (!Trace::isEnabled()) {
+                Trace::clear();
+                Trace::setEnabled(true);
+            }
+            else {
+                Trace::setEnabled(false);
+                if (Trace::writeChromeJson("trace.json")) {
+                    std::cout << "Wrote trace.json (" << Trace::getDroppedEvents() << " events dropped)" << std::endl;
+                }
             }
         }
+        traceKeyDown = traceKey;
 
         fluid.step();
 
         // Update intensity grid based on density
-        for (int i = 0; i < simSize; i++) {
-            for (int j = 0; j < simSize; j++) {
-                if (fluid.isObstacle(i, j)) {
-                    intensityGrid[i * simSize + j] = 0.0f;
-                    continue;
+        {
+            TRACE_SCOPE("intensity update");
+            FluidSim::FieldView<bool> obstacleView = fluid.getObstacleView();
+            const TiledField& densityField = fluid.getDensityField();
+            for (int i = 0; i < simSize; i++) {
+                for (int j = 0; j < simSize; j++) {
+                    if (obstacleView.at(i, j)) {
+                        intensityGrid[i * simSize + j] = 0.0f;
+                        continue;
+                    }
+
+                    float d = densityField.get(i, j);
+                    float targetIntensity = d / 1000.0f; // Fixed scale for consistent brightness
+                    if (targetIntensity > 1.0f) targetIntensity = 1.0f;
+
+                    // Smooth transition with high persistence
+                    intensityGrid[i * simSize + j] =
+                        0.75f * intensityGrid[i * simSize + j] +
+                        0.25f * targetIntensity;
                 }
-
-                float d;
-                fluid.getDensity(i, j, d);
-                float targetIntensity = d / 1000.0f; // Fixed scale for consistent brightness
-                if (targetIntensity > 1.0f) targetIntensity = 1.0f;
-
-                // Smooth transition with high persistence
-                intensityGrid[i * simSize + j] =
-                    0.75f * intensityGrid[i * simSize + j] +
-                    0.25f * targetIntensity;
             }
-        }
 
-        // Update point intensities
-        for (int i = 0; i < simSize; i++) {
-            for (int j = 0; j < simSize; j++) {
-                int idx = i * simSize + j;
-                pointData[idx].intensity = intensityGrid[idx];
+            // Update point intensities
+            for (int i = 0; i < simSize; i++) {
+                for (int j = 0; j < simSize; j++) {
+                    int idx = i * simSize + j;
+                    pointData[idx].intensity = intensityGrid[idx];
+                }
             }
         }
 
         // Update VBO
-        glBindBuffer(GL_ARRAY_BUFFER, pointVBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, pointData.size() * sizeof(FluidPoint), pointData.data());
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        {
+            TRACE_SCOPE("glBufferSubData");
+            glBindBuffer(GL_ARRAY_BUFFER, pointVBO);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, pointData.size() * sizeof(FluidPoint), pointData.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
 
         // Render
-        glClearColor(0.05f, 0.05f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        // Draw fluid points
-        glUseProgram(pointShaderProgram);
-        glBindVertexArray(pointVAO);
-        glDrawArrays(GL_POINTS, 0, pointData.size());
-        glBindVertexArray(0);
-        glUseProgram(0);
-
-        // Draw obstacle
-        glUseProgram(obstacleShaderProgram);
-        glBindVertexArray(obstacleVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
-        glUseProgram(0);
-
-        glfwSwapBuffers(window);
+        {
+            TRACE_SCOPE("draw");
+            glClearColor(0.05f, 0.05f, 0.1f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            // Draw fluid points
+            glUseProgram(pointShaderProgram);
+            glBindVertexArray(pointVAO);
+            glDrawArrays(GL_POINTS, 0, pointData.size());
+            glBindVertexArray(0);
+            glUseProgram(0);
+
+            // Draw obstacle
+            glUseProgram(obstacleShaderProgram);
+            glBindVertexArray(obstacleVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            glBindVertexArray(0);
+            glUseProgram(0);
+        }
+
+        {
+            TRACE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
     }
 